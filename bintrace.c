@@ -0,0 +1,538 @@
+/*
+ * Compact binary traces for the malloc lab driver
+ *
+ * See bintrace.h for the format.  Both kinds of trace are mapped rather
+ * than read: a binary trace is used where it lies, and a .rep file is
+ * parsed straight out of its mapping, a good deal faster than with
+ * fscanf, and packed into a buffer of its own.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bintrace.h"
+
+/* Longest LEB128 encoding of a 64-bit value */
+#define MAX_VARINT_BYTES 10
+
+/* Packed buffer that grows as a .rep file is parsed */
+typedef struct
+{
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} buffer_t;
+
+static const char *map_file(const char *path, void **map, size_t *len);
+static const char *open_binary(bintrace_t *bt);
+static const char *read_header(bintrace_t *bt, const unsigned char *header,
+                               uint64_t file_len);
+static const char *parse_rep(bintrace_t *bt, const char *text, size_t len);
+static const char *pack_rep(bintrace_t *bt, const char *text, size_t len,
+                            buffer_t *buf);
+static const char *check_ops(const bintrace_t *bt);
+static bool put_varint(buffer_t *buf, uint64_t val);
+static size_t encode_varint(unsigned char *p, uint64_t val);
+static size_t encode_op(const traceop_t *op, unsigned char *p);
+static void put_u64(unsigned char *p, uint64_t val);
+static uint64_t get_u64(const unsigned char *p);
+static bool refill(bt_stream_t *st);
+static const unsigned char *varint_end(const unsigned char *p,
+                                       const unsigned char *end);
+
+const char *bt_open(bintrace_t *bt, const char *path)
+{
+    void *map;
+    size_t len;
+    const char *msg;
+
+    memset(bt, 0, sizeof(*bt));
+    if ((msg = map_file(path, &map, &len)) != NULL)
+        return msg;
+
+    if (len >= BT_HEADER_BYTES && memcmp(map, BT_MAGIC, 4) == 0)
+    {
+        bt->map = map;
+        bt->map_len = len;
+        msg = open_binary(bt);
+    }
+    else
+    {
+        msg = parse_rep(bt, map, len);
+        if (len > 0)
+            munmap(map, len);
+    }
+
+    if (msg != NULL)
+        bt_close(bt);
+    return msg;
+}
+
+void bt_close(bintrace_t *bt)
+{
+    if (bt->map != NULL)
+        munmap(bt->map, bt->map_len);
+    else
+        free((void *)bt->ops);
+    memset(bt, 0, sizeof(*bt));
+}
+
+bool bt_write_binary(const bintrace_t *bt, FILE *fp)
+{
+    return bt_put_header(bt, fp, true) &&
+           fwrite(bt->ops, 1, bt->ops_bytes, fp) == bt->ops_bytes;
+}
+
+bool bt_write_rep(const bintrace_t *bt, FILE *fp)
+{
+    bt_cursor_t cursor;
+    traceop_t op;
+
+    bt_put_header(bt, fp, false);
+    bt_rewind(bt, &cursor);
+    while (bt_next(&cursor, &op))
+        bt_put_op(&op, fp, false);
+    return !ferror(fp);
+}
+
+bool bt_put_header(const bintrace_t *bt, FILE *fp, bool binary)
+{
+    unsigned char header[BT_HEADER_BYTES];
+
+    if (!binary)
+    {
+        fprintf(fp, "%d\n%lu\n%lu\n%lu\n", bt->weight,
+                (unsigned long)bt->num_ids, (unsigned long)bt->num_ops,
+                (unsigned long)bt->data_bytes);
+        return !ferror(fp);
+    }
+    memcpy(header, BT_MAGIC, 4);
+    header[4] = BT_VERSION & 0xff;
+    header[5] = BT_VERSION >> 8;
+    header[6] = bt->weight & 0xff;
+    header[7] = bt->weight >> 8;
+    put_u64(header + 8, bt->num_ids);
+    put_u64(header + 16, bt->num_ops);
+    put_u64(header + 24, bt->data_bytes);
+    put_u64(header + 32, bt->ops_bytes);
+    return fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+}
+
+bool bt_put_op(const traceop_t *op, FILE *fp, bool binary)
+{
+    unsigned char packed[BT_MAX_OP_BYTES];
+    size_t len;
+
+    if (!binary)
+    {
+        if (op->type == ALLOC)
+            fprintf(fp, "a %ld %zu\n", op->index, op->size);
+        else if (op->type == REALLOC)
+            fprintf(fp, "r %ld %zu\n", op->index, op->size);
+        else
+            fprintf(fp, "f %ld\n", op->index);
+        return !ferror(fp);
+    }
+    len = encode_op(op, packed);
+    return fwrite(packed, 1, len, fp) == len;
+}
+
+size_t bt_op_bytes(const traceop_t *op)
+{
+    unsigned char packed[BT_MAX_OP_BYTES];
+    return encode_op(op, packed);
+}
+
+const char *bt_stream_open(bt_stream_t *st, const char *path, size_t window)
+{
+    unsigned char header[BT_HEADER_BYTES];
+    struct stat st_file;
+    const char *msg;
+    int i;
+
+    memset(st, 0, sizeof(*st));
+    st->fd = -1;
+    if ((st->fd = open(path, O_RDONLY)) < 0 || fstat(st->fd, &st_file) != 0)
+    {
+        msg = strerror(errno);
+        bt_stream_close(st);
+        return msg;
+    }
+    if (st_file.st_size < BT_HEADER_BYTES ||
+        pread(st->fd, header, BT_HEADER_BYTES, 0) != BT_HEADER_BYTES)
+    {
+        bt_stream_close(st);
+        return "truncated header";
+    }
+    if ((msg = read_header(&st->bt, header, (uint64_t)st_file.st_size)) !=
+        NULL)
+    {
+        bt_stream_close(st);
+        return msg;
+    }
+
+    /* Each buffer also holds the tail of a record cut off by the window */
+    st->window = window;
+    for (i = 0; i < 2; i++)
+    {
+        if ((st->buf[i] = malloc(window + BT_MAX_OP_BYTES)) == NULL)
+        {
+            bt_stream_close(st);
+            return strerror(ENOMEM);
+        }
+    }
+    st->offset = BT_HEADER_BYTES;
+    st->remaining = st->bt.ops_bytes;
+    st->cursor.next = st->cursor.end = st->buf[0];
+    posix_fadvise(st->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(st->fd, st->offset, window, POSIX_FADV_WILLNEED);
+    return NULL;
+}
+
+void bt_stream_close(bt_stream_t *st)
+{
+    if (st->fd >= 0)
+        close(st->fd);
+    free(st->buf[0]);
+    free(st->buf[1]);
+    memset(st, 0, sizeof(*st));
+    st->fd = -1;
+}
+
+bool bt_stream_next(bt_stream_t *st, traceop_t *op)
+{
+    bt_cursor_t *cursor = &st->cursor;
+    if (cursor->end - cursor->next < BT_MAX_OP_BYTES && st->remaining > 0 &&
+        !refill(st))
+        return false;
+    if (cursor->next == cursor->end)
+    {
+        if (st->ops_read != st->bt.num_ops)
+            st->error = "number of requests does not match the header";
+        return false;
+    }
+
+    /* Nothing has checked these requests yet */
+    const unsigned char *p = varint_end(cursor->next, cursor->end);
+    if (p != NULL && (*cursor->next & 0x3) != FREE)
+        p = varint_end(p, cursor->end);
+    if (p == NULL)
+    {
+        st->error = "truncated or overlong varint";
+        return false;
+    }
+    bt_next(cursor, op);
+    if ((int)op->type > REALLOC)
+        st->error = "bogus request type";
+    else if ((uint64_t)(op->index + 1) > st->bt.num_ids)
+        st->error = "request id out of range";
+    else if (op->index < 0 && op->type != FREE)
+        st->error = "bad request id";
+    else
+    {
+        st->ops_read++;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * refill - move what is left of the front buffer to the start of the back
+ *     one, read the next window after it, and swap the buffers.  The
+ *     window after that is read ahead by the kernel meanwhile.
+ */
+static bool refill(bt_stream_t *st)
+{
+    size_t left = st->cursor.end - st->cursor.next;
+    unsigned char *back = st->buf[1 - st->front];
+    size_t len = st->remaining < st->window ? st->remaining : st->window;
+
+    memcpy(back, st->cursor.next, left);
+    ssize_t got = pread(st->fd, back + left, len, st->offset);
+    if (got != (ssize_t)len)
+    {
+        st->error = got < 0 ? strerror(errno) : "trace ends early";
+        return false;
+    }
+    st->offset += len;
+    st->remaining -= len;
+    if (st->remaining > 0)
+        posix_fadvise(st->fd, st->offset, st->window, POSIX_FADV_WILLNEED);
+
+    st->front = 1 - st->front;
+    st->cursor.next = back;
+    st->cursor.end = back + left + len;
+    return true;
+}
+
+/*
+ * map_file - map the whole of a file read-only.  An empty file gets a
+ *     NULL mapping of length 0.
+ */
+static const char *map_file(const char *path, void **map, size_t *len)
+{
+    struct stat st;
+    int fd;
+
+    *map = NULL;
+    *len = 0;
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return strerror(errno);
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return strerror(errno);
+    }
+
+    *len = (size_t)st.st_size;
+    if (*len > 0)
+    {
+        *map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (*map == MAP_FAILED)
+        {
+            close(fd);
+            return strerror(errno);
+        }
+        /* Traces are replayed several times, so read it all in now */
+        madvise(*map, *len, MADV_WILLNEED);
+    }
+    close(fd);
+    return NULL;
+}
+
+/*
+ * open_binary - check the header of a mapped binary trace and point the
+ *     trace at its requests
+ */
+static const char *open_binary(bintrace_t *bt)
+{
+    const char *msg;
+
+    if (bt->map_len < BT_HEADER_BYTES)
+        return "truncated header";
+    if ((msg = read_header(bt, bt->map, bt->map_len)) != NULL)
+        return msg;
+    bt->ops = (const unsigned char *)bt->map + BT_HEADER_BYTES;
+    return check_ops(bt);
+}
+
+/*
+ * read_header - fill in the trace from the header of a binary trace file
+ *     of file_len bytes
+ */
+static const char *read_header(bintrace_t *bt, const unsigned char *header,
+                               uint64_t file_len)
+{
+    if (memcmp(header, BT_MAGIC, 4) != 0)
+        return "not a binary trace";
+    if ((header[4] | header[5] << 8) != BT_VERSION)
+        return "unsupported binary trace version";
+    bt->weight = header[6] | header[7] << 8;
+    bt->num_ids = get_u64(header + 8);
+    bt->num_ops = get_u64(header + 16);
+    bt->data_bytes = get_u64(header + 24);
+    bt->ops_bytes = get_u64(header + 32);
+    if (bt->ops_bytes != file_len - BT_HEADER_BYTES)
+        return "length of the requests does not match the header";
+    return NULL;
+}
+
+/*
+ * next_token - skip white space and return the start of the next token,
+ *     or NULL at the end of the text
+ */
+static const char *next_token(const char **p, const char *end)
+{
+    while (*p < end && (**p == ' ' || **p == '\t' || **p == '\n' ||
+                        **p == '\r'))
+        (*p)++;
+    return *p < end ? *p : NULL;
+}
+
+/*
+ * parse_number - parse a decimal number, with an optional minus sign
+ */
+static bool parse_number(const char **p, const char *end, long *val)
+{
+    bool negative = false;
+    if (next_token(p, end) == NULL)
+        return false;
+    if (**p == '-')
+    {
+        negative = true;
+        (*p)++;
+    }
+    if (*p == end || **p < '0' || **p > '9')
+        return false;
+
+    unsigned long n = 0;
+    while (*p < end && **p >= '0' && **p <= '9')
+        n = n * 10 + (unsigned long)(*(*p)++ - '0');
+    *val = negative ? -(long)n : (long)n;
+    return true;
+}
+
+/*
+ * parse_rep - parse the text of a .rep file and pack its requests.  The
+ *     buffer is handed to the trace even on failure, for bt_close to free.
+ */
+static const char *parse_rep(bintrace_t *bt, const char *text, size_t len)
+{
+    buffer_t buf = {NULL, 0, 0};
+    const char *msg = pack_rep(bt, text, len, &buf);
+    bt->ops = buf.data;
+    bt->ops_bytes = buf.len;
+    return msg;
+}
+
+static const char *pack_rep(bintrace_t *bt, const char *text, size_t len,
+                            buffer_t *buf)
+{
+    const char *p = text, *end = text + len;
+    long header[4], index, size, max_index = -1;
+    uint64_t n;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        if (!parse_number(&p, end, &header[i]) || header[i] < 0)
+            return "bad .rep header";
+    bt->weight = (int)header[0];
+    bt->num_ids = (uint64_t)header[1];
+    bt->num_ops = (uint64_t)header[2];
+    bt->data_bytes = (uint64_t)header[3];
+
+    /* Start with room for the typical few bytes a request */
+    buf->cap = bt->num_ops * 4 + MAX_VARINT_BYTES;
+    if ((buf->data = malloc(buf->cap)) == NULL)
+        return strerror(ENOMEM);
+
+    for (n = 0; n < bt->num_ops; n++)
+    {
+        if (next_token(&p, end) == NULL)
+            return "fewer requests than the header says";
+        char type = *p++;
+        if (type != 'a' && type != 'r' && type != 'f')
+            return "bogus request type";
+        if (!parse_number(&p, end, &index) || index < -1 ||
+            (index == -1 && type != 'f'))
+            return "bad request id";
+        if (index > max_index)
+            max_index = index;
+
+        int code = type == 'a' ? ALLOC : type == 'r' ? REALLOC : FREE;
+        if (!put_varint(buf, (uint64_t)(index + 1) << 2 | code))
+            return strerror(ENOMEM);
+        if (type != 'f')
+        {
+            if (!parse_number(&p, end, &size) || size < 0)
+                return "bad request size";
+            if (!put_varint(buf, (uint64_t)size))
+                return strerror(ENOMEM);
+        }
+    }
+
+    if ((uint64_t)(max_index + 1) != bt->num_ids)
+        return "request ids do not match the header";
+    return NULL;
+}
+
+/*
+ * check_ops - make sure every request of a binary trace decodes inside
+ *     the mapping and names a known id, so that bt_next need not check
+ */
+static const char *check_ops(const bintrace_t *bt)
+{
+    const unsigned char *p = bt->ops, *end = bt->ops + bt->ops_bytes;
+    uint64_t n, word;
+
+    for (n = 0; p < end; n++)
+    {
+        if (varint_end(p, end) == NULL)
+            return "truncated or overlong varint";
+        word = bt_varint(&p);
+        if ((word & 0x3) > REALLOC)
+            return "bogus request type";
+        if ((word >> 2) > bt->num_ids)
+            return "request id out of range";
+        if ((word >> 2) == 0 && (word & 0x3) != FREE)
+            return "bad request id";
+        if ((word & 0x3) != FREE && (p = varint_end(p, end)) == NULL)
+            return "truncated or overlong varint";
+    }
+    if (n != bt->num_ops)
+        return "number of requests does not match the header";
+    return NULL;
+}
+
+/*
+ * varint_end - return the end of the varint at p, or NULL if it runs past
+ *     end or is longer than any 64-bit value needs
+ */
+static const unsigned char *varint_end(const unsigned char *p,
+                                       const unsigned char *end)
+{
+    int i;
+    for (i = 0; i < MAX_VARINT_BYTES && p + i < end; i++)
+        if (!(p[i] & 0x80))
+            return p + i + 1;
+    return NULL;
+}
+
+static bool put_varint(buffer_t *buf, uint64_t val)
+{
+    if (buf->len + MAX_VARINT_BYTES > buf->cap)
+    {
+        size_t cap = buf->cap * 2;
+        unsigned char *data = realloc(buf->data, cap);
+        if (data == NULL)
+            return false;
+        buf->data = data;
+        buf->cap = cap;
+    }
+    buf->len += encode_varint(buf->data + buf->len, val);
+    return true;
+}
+
+/*
+ * encode_varint - write val at p as a LEB128 varint, returning its length
+ */
+static size_t encode_varint(unsigned char *p, uint64_t val)
+{
+    size_t len = 0;
+    do
+    {
+        unsigned char byte = val & 0x7f;
+        val >>= 7;
+        p[len++] = byte | (val != 0 ? 0x80 : 0);
+    } while (val != 0);
+    return len;
+}
+
+static size_t encode_op(const traceop_t *op, unsigned char *p)
+{
+    size_t len = encode_varint(p, (uint64_t)(op->index + 1) << 2 | op->type);
+    if (op->type != FREE)
+        len += encode_varint(p + len, (uint64_t)op->size);
+    return len;
+}
+
+static void put_u64(unsigned char *p, uint64_t val)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+        p[i] = (unsigned char)(val >> (8 * i));
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+    uint64_t val = 0;
+    int i;
+    for (i = 0; i < 8; i++)
+        val |= (uint64_t)p[i] << (8 * i);
+    return val;
+}
@@ -0,0 +1,162 @@
+/*
+ * Compact binary traces for the malloc lab driver
+ *
+ * A binary trace holds the same requests as a .rep file (see
+ * traces/README).  It starts with a fixed header of little-endian fields:
+ *
+ *   offset  size
+ *        0     4   magic, "MLBT"
+ *        4     2   format version, BT_VERSION
+ *        6     2   weight
+ *        8     8   number of request ids
+ *       16     8   number of requests
+ *       24     8   peak data bytes allocated
+ *       32     8   length in bytes of the requests that follow
+ *
+ * Each request is then packed into one or two LEB128 varints: first
+ * (id + 1) << 2 | type, with type one of ALLOC, FREE and REALLOC and id -1
+ * standing for free(NULL), then, for ALLOC and REALLOC only, the size.
+ * Most requests take three to five bytes, against the 24 of a traceop_t.
+ *
+ * bt_open maps a binary trace read-only and checks every request once, so
+ * that a replay can decode straight out of the mapping with bt_next and no
+ * further checks.  A .rep file is parsed and packed into memory in the same
+ * form, so that the driver handles both alike.
+ */
+#ifndef BINTRACE_H
+#define BINTRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BT_MAGIC "MLBT"
+#define BT_VERSION 1
+#define BT_HEADER_BYTES 40
+
+/* Longest packed request: two 10-byte varints */
+#define BT_MAX_OP_BYTES 20
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct
+{
+    enum
+    {
+        ALLOC,
+        FREE,
+        REALLOC
+    } type;      /* type of request */
+    long index;  /* index for free() to use later */
+    size_t size; /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* A trace opened by bt_open */
+typedef struct
+{
+    int weight;
+    uint64_t num_ids;
+    uint64_t num_ops;
+    uint64_t data_bytes;
+    const unsigned char *ops; /* Packed requests */
+    size_t ops_bytes;
+    void *map;      /* Mapping of a binary trace, or NULL */
+    size_t map_len;
+} bintrace_t;
+
+/* Position in the packed requests of a trace */
+typedef struct
+{
+    const unsigned char *next;
+    const unsigned char *end;
+} bt_cursor_t;
+
+/*
+ * A binary trace read a window at a time, for traces too large to map.
+ * Reading alternates between two buffers, and the kernel is asked to read
+ * ahead the next window while the requests of the current one are used.
+ */
+typedef struct
+{
+    bt_cursor_t cursor;        /* Requests left in the front buffer */
+    bintrace_t bt;             /* Header only; ops is not used */
+    int fd;
+    unsigned char *buf[2];
+    int front;                 /* Buffer that cursor points into */
+    size_t window;             /* Bytes read at a time */
+    uint64_t offset;           /* File offset of the next window */
+    uint64_t remaining;        /* Bytes of requests not yet read */
+    uint64_t ops_read;
+    const char *error;         /* Why bt_stream_next stopped early */
+} bt_stream_t;
+
+/*
+ * Open a binary or .rep trace, telling them apart by the magic number.
+ * Returns NULL on success, or else a message saying what is wrong.
+ */
+const char *bt_open(bintrace_t *bt, const char *path);
+
+void bt_close(bintrace_t *bt);
+
+/*
+ * Open a binary trace for reading window bytes at a time.  Returns NULL on
+ * success, or else a message saying what is wrong.
+ */
+const char *bt_stream_open(bt_stream_t *st, const char *path, size_t window);
+
+void bt_stream_close(bt_stream_t *st);
+
+/*
+ * Decode the next request of a stream into op.  Returns false at the end
+ * of the trace, or on a failure, when st->error says what went wrong.
+ */
+bool bt_stream_next(bt_stream_t *st, traceop_t *op);
+
+/* Write a trace in either format; false on an I/O failure */
+bool bt_write_binary(const bintrace_t *bt, FILE *fp);
+bool bt_write_rep(const bintrace_t *bt, FILE *fp);
+
+/*
+ * Write a trace a request at a time, for traces that are made rather than
+ * read: the header first, whose counts and ops_bytes must already be
+ * known, then each request.  False on an I/O failure.
+ */
+bool bt_put_header(const bintrace_t *bt, FILE *fp, bool binary);
+bool bt_put_op(const traceop_t *op, FILE *fp, bool binary);
+
+/* Bytes that a request takes in a binary trace */
+size_t bt_op_bytes(const traceop_t *op);
+
+static inline void bt_rewind(const bintrace_t *bt, bt_cursor_t *cursor)
+{
+    cursor->next = bt->ops;
+    cursor->end = bt->ops + bt->ops_bytes;
+}
+
+static inline uint64_t bt_varint(const unsigned char **p)
+{
+    uint64_t val = 0;
+    int shift = 0;
+    unsigned char byte;
+    do
+    {
+        byte = *(*p)++;
+        val |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return val;
+}
+
+/* Decode the next request into op; false at the end of the trace */
+static inline bool bt_next(bt_cursor_t *cursor, traceop_t *op)
+{
+    if (cursor->next == cursor->end)
+        return false;
+    uint64_t word = bt_varint(&cursor->next);
+    op->type = (int)(word & 0x3);
+    op->index = (long)(word >> 2) - 1;
+    op->size = op->type == FREE ? 0 : (size_t)bt_varint(&cursor->next);
+    return true;
+}
+
+#endif /* BINTRACE_H */
@@ -0,0 +1,384 @@
+/*
+ * B+ tree of address ranges
+ *
+ * See btree.h.  An inner node with n children holds n - 1 keys, where
+ * keys[i] is no greater than any range under children i + 1 and up, and
+ * greater than every range under children 0 to i.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+
+/* Nodes in each chunk of the pool */
+#define CHUNK_NODES 64
+
+/* Deeper than any tree of ranges that fit in memory */
+#define MAX_HEIGHT 32
+
+struct btnode
+{
+    int leaf;
+    int count;      /* Ranges in a leaf, children in an inner node */
+    btnode_t *prev; /* Neighbors of a leaf in address order */
+    btnode_t *next; /* ... and the link of a node in the free list */
+    union
+    {
+        btrange_t ranges[BTREE_LEAF];
+        struct
+        {
+            uintptr_t keys[BTREE_FANOUT];
+            btnode_t *child[BTREE_FANOUT + 1];
+        } inner;
+    };
+};
+
+typedef struct chunk
+{
+    struct chunk *next;
+    btnode_t nodes[CHUNK_NODES];
+} chunk_t;
+
+/*
+ * new_node - take a node from the free list or the newest chunk
+ */
+static btnode_t *new_node(btree_t *tree, bool leaf)
+{
+    btnode_t *node;
+    chunk_t *chunk = tree->chunks;
+
+    if (tree->free_nodes != NULL)
+    {
+        node = tree->free_nodes;
+        tree->free_nodes = node->next;
+    }
+    else
+    {
+        if (chunk == NULL || tree->chunk_used == CHUNK_NODES)
+        {
+            if ((chunk = malloc(sizeof(chunk_t))) == NULL)
+            {
+                fprintf(stderr, "ERROR.  Couldn't grow range tree\n");
+                exit(1);
+            }
+            chunk->next = tree->chunks;
+            tree->chunks = chunk;
+            tree->chunk_used = 0;
+        }
+        node = &chunk->nodes[tree->chunk_used++];
+    }
+    node->leaf = leaf;
+    node->count = 0;
+    node->prev = node->next = NULL;
+    return node;
+}
+
+static void release(btree_t *tree, btnode_t *node)
+{
+    node->next = tree->free_nodes;
+    tree->free_nodes = node;
+}
+
+btree_t *btree_new(void)
+{
+    btree_t *tree = calloc(1, sizeof(btree_t));
+    if (tree == NULL)
+    {
+        fprintf(stderr, "ERROR.  Couldn't create range tree\n");
+        exit(1);
+    }
+    tree->root = new_node(tree, true);
+    tree->height = 1;
+    return tree;
+}
+
+void btree_free(btree_t *tree)
+{
+    chunk_t *chunk = tree->chunks;
+    while (chunk != NULL)
+    {
+        chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(tree);
+}
+
+void btree_reset(btree_t *tree)
+{
+    chunk_t *chunk;
+    size_t i, used = tree->chunk_used;
+
+    /* Put every node handed out back on the free list */
+    tree->free_nodes = NULL;
+    for (chunk = tree->chunks; chunk != NULL; chunk = chunk->next)
+    {
+        for (i = 0; i < used; i++)
+            release(tree, &chunk->nodes[i]);
+        used = CHUNK_NODES;
+    }
+    tree->chunk_used = CHUNK_NODES;
+    tree->root = new_node(tree, true);
+    tree->count = 0;
+    tree->height = 1;
+}
+
+/* Child of an inner node under which key belongs */
+static int child_slot(const btnode_t *node, uintptr_t key)
+{
+    int lo = 0, hi = node->count - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (node->inner.keys[mid] <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* First range of a leaf whose lo is greater than key, or after equal */
+static int leaf_slot(const btnode_t *node, uintptr_t key, bool after_equal)
+{
+    int lo = 0, hi = node->count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        uintptr_t k = node->ranges[mid].lo;
+        if (k < key || (after_equal && k == key))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * add_child - put child into an inner node just after slot i, with key
+ *     as the lowest key under it.  The node must have room.
+ */
+static void add_child(btnode_t *node, int i, uintptr_t key, btnode_t *child)
+{
+    int keys = node->count - 1;
+    memmove(&node->inner.keys[i + 1], &node->inner.keys[i],
+            (keys - i) * sizeof(uintptr_t));
+    memmove(&node->inner.child[i + 2], &node->inner.child[i + 1],
+            (node->count - i - 1) * sizeof(btnode_t *));
+    node->inner.keys[i] = key;
+    node->inner.child[i + 1] = child;
+    node->count++;
+}
+
+/*
+ * split_inner - add a child to a full inner node by splitting it in two.
+ *     Returns the new right half, and its lowest key in *key.
+ */
+static btnode_t *split_inner(btree_t *tree, btnode_t *node, int i,
+                             uintptr_t *key, btnode_t *child)
+{
+    uintptr_t keys[BTREE_FANOUT + 1];
+    btnode_t *children[BTREE_FANOUT + 2];
+    int nkeys = BTREE_FANOUT + 1, mid = nkeys / 2;
+
+    memcpy(keys, node->inner.keys, i * sizeof(uintptr_t));
+    keys[i] = *key;
+    memcpy(keys + i + 1, node->inner.keys + i,
+           (BTREE_FANOUT - i) * sizeof(uintptr_t));
+    memcpy(children, node->inner.child, (i + 1) * sizeof(btnode_t *));
+    children[i + 1] = child;
+    memcpy(children + i + 2, node->inner.child + i + 1,
+           (BTREE_FANOUT - i) * sizeof(btnode_t *));
+
+    /* The middle key moves up, between the two halves */
+    btnode_t *right = new_node(tree, false);
+    memcpy(node->inner.keys, keys, mid * sizeof(uintptr_t));
+    memcpy(node->inner.child, children, (mid + 1) * sizeof(btnode_t *));
+    node->count = mid + 1;
+    memcpy(right->inner.keys, keys + mid + 1,
+           (nkeys - mid - 1) * sizeof(uintptr_t));
+    memcpy(right->inner.child, children + mid + 1,
+           (nkeys - mid) * sizeof(btnode_t *));
+    right->count = nkeys - mid;
+    *key = keys[mid];
+    return right;
+}
+
+/*
+ * split_leaf - split a full leaf in two, linking the right half after it
+ */
+static btnode_t *split_leaf(btree_t *tree, btnode_t *node)
+{
+    btnode_t *right = new_node(tree, true);
+    int half = BTREE_LEAF / 2;
+
+    memcpy(right->ranges, node->ranges + half,
+           (BTREE_LEAF - half) * sizeof(btrange_t));
+    right->count = BTREE_LEAF - half;
+    node->count = half;
+
+    right->prev = node;
+    right->next = node->next;
+    if (node->next != NULL)
+        node->next->prev = right;
+    node->next = right;
+    return right;
+}
+
+bool btree_insert(btree_t *tree, uintptr_t lo, uintptr_t hi, long index)
+{
+    btnode_t *path[MAX_HEIGHT];
+    int slot[MAX_HEIGHT];
+    int depth = 0, pos;
+    btnode_t *node = tree->root;
+
+    while (!node->leaf)
+    {
+        path[depth] = node;
+        slot[depth] = child_slot(node, lo);
+        node = node->inner.child[slot[depth++]];
+    }
+    pos = leaf_slot(node, lo, false);
+    if (pos < node->count && node->ranges[pos].lo == lo)
+        return false;
+    tree->count++;
+
+    btnode_t *right = NULL;
+    if (node->count == BTREE_LEAF)
+    {
+        right = split_leaf(tree, node);
+        if (pos > node->count)
+        {
+            pos -= node->count;
+            node = right;
+        }
+    }
+    memmove(&node->ranges[pos + 1], &node->ranges[pos],
+            (node->count - pos) * sizeof(btrange_t));
+    node->ranges[pos] = (btrange_t){lo, hi, index};
+    node->count++;
+    if (right == NULL)
+        return true;
+
+    /* Add the new node to its parent, splitting upwards as needed */
+    uintptr_t key = right->ranges[0].lo;
+    while (depth > 0)
+    {
+        btnode_t *parent = path[--depth];
+        if (parent->count <= BTREE_FANOUT)
+        {
+            add_child(parent, slot[depth], key, right);
+            return true;
+        }
+        right = split_inner(tree, parent, slot[depth], &key, right);
+    }
+
+    btnode_t *root = new_node(tree, false);
+    root->inner.child[0] = tree->root;
+    root->inner.child[1] = right;
+    root->inner.keys[0] = key;
+    root->count = 2;
+    tree->root = root;
+    tree->height++;
+    return true;
+}
+
+bool btree_remove(btree_t *tree, uintptr_t lo)
+{
+    btnode_t *path[MAX_HEIGHT];
+    int slot[MAX_HEIGHT];
+    int depth = 0, pos, i;
+    btnode_t *node = tree->root;
+
+    while (!node->leaf)
+    {
+        path[depth] = node;
+        slot[depth] = child_slot(node, lo);
+        node = node->inner.child[slot[depth++]];
+    }
+    pos = leaf_slot(node, lo, false);
+    if (pos == node->count || node->ranges[pos].lo != lo)
+        return false;
+    memmove(&node->ranges[pos], &node->ranges[pos + 1],
+            (node->count - pos - 1) * sizeof(btrange_t));
+    node->count--;
+    tree->count--;
+
+    /* Give back nodes left empty, all the way up if need be */
+    while (node->count == 0 && depth > 0)
+    {
+        if (node->leaf)
+        {
+            if (node->prev != NULL)
+                node->prev->next = node->next;
+            if (node->next != NULL)
+                node->next->prev = node->prev;
+        }
+        release(tree, node);
+
+        node = path[--depth];
+        i = slot[depth];
+        int key = i > 0 ? i - 1 : 0;
+        if (node->count > 1)
+            memmove(&node->inner.keys[key], &node->inner.keys[key + 1],
+                    (node->count - 2 - key) * sizeof(uintptr_t));
+        memmove(&node->inner.child[i], &node->inner.child[i + 1],
+                (node->count - i - 1) * sizeof(btnode_t *));
+        node->count--;
+    }
+
+    /* A root with a single child is not needed */
+    while (!tree->root->leaf && tree->root->count == 1)
+    {
+        node = tree->root;
+        tree->root = node->inner.child[0];
+        release(tree, node);
+        tree->height--;
+    }
+    return true;
+}
+
+void btree_neighbors(btree_t *tree, uintptr_t key, btrange_t **prev,
+                     btrange_t **next)
+{
+    btnode_t *node = tree->root;
+    int pos;
+
+    while (!node->leaf)
+        node = node->inner.child[child_slot(node, key)];
+    pos = leaf_slot(node, key, true);
+
+    if (pos < node->count)
+        *next = &node->ranges[pos];
+    else
+        *next = node->next != NULL ? &node->next->ranges[0] : NULL;
+    if (pos > 0)
+        *prev = &node->ranges[pos - 1];
+    else
+        *prev = node->prev != NULL ? &node->prev->ranges[node->prev->count - 1]
+                                   : NULL;
+}
+
+btrange_t *btree_first(btree_t *tree, btree_iter_t *iter)
+{
+    btnode_t *node = tree->root;
+    while (!node->leaf)
+        node = node->inner.child[0];
+    iter->leaf = node;
+    iter->pos = 0;
+    return node->count > 0 ? &node->ranges[0] : NULL;
+}
+
+btrange_t *btree_next(btree_iter_t *iter)
+{
+    if (++iter->pos == iter->leaf->count)
+    {
+        iter->leaf = iter->leaf->next;
+        iter->pos = 0;
+        if (iter->leaf == NULL)
+            return NULL;
+    }
+    return &iter->leaf->ranges[iter->pos];
+}
@@ -0,0 +1,75 @@
+/*
+ * B+ tree of address ranges, used by the driver to check that payloads
+ * never overlap
+ *
+ * Each leaf holds up to BTREE_LEAF ranges sorted by low address, in place
+ * rather than behind pointers, and the leaves are linked in order, so that
+ * finding the neighbors of an address touches a few contiguous nodes and
+ * walking every range is a scan.  Nodes come from a pool of fixed-size
+ * chunks that is only given back to libc by btree_free; btree_reset empties
+ * the tree for the next trace without freeing anything.
+ *
+ * Removing a range never merges nodes, but nodes that become empty are
+ * returned to the pool, so no leaf on the chain is ever empty.
+ */
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Most ranges in a leaf, and most keys in an inner node */
+#define BTREE_LEAF 32
+#define BTREE_FANOUT 32
+
+typedef struct
+{
+    uintptr_t lo; /* Low payload address, the key */
+    uintptr_t hi; /* High payload address */
+    long index;   /* Trace id of the block */
+} btrange_t;
+
+typedef struct btnode btnode_t;
+
+typedef struct
+{
+    btnode_t *root;
+    btnode_t *free_nodes; /* Nodes given back, linked through next */
+    void *chunks;         /* Chunks of nodes from libc, linked */
+    size_t chunk_used;    /* Nodes handed out from the newest chunk */
+    size_t count;         /* Number of ranges held */
+    int height;           /* 1 when the root is a leaf */
+} btree_t;
+
+/* Position in the ordered walk of a tree */
+typedef struct
+{
+    btnode_t *leaf;
+    int pos;
+} btree_iter_t;
+
+btree_t *btree_new(void);
+void btree_free(btree_t *tree);
+
+/* Remove every range, keeping the nodes for reuse */
+void btree_reset(btree_t *tree);
+
+/* Add a range; false if there is already one starting at lo */
+bool btree_insert(btree_t *tree, uintptr_t lo, uintptr_t hi, long index);
+
+/* Remove the range starting at lo; false if there is none */
+bool btree_remove(btree_t *tree, uintptr_t lo);
+
+/*
+ * Find the ranges on either side of key: *prev gets the one with the
+ * largest lo <= key and *next the one with the smallest lo > key, or NULL
+ */
+void btree_neighbors(btree_t *tree, uintptr_t key, btrange_t **prev,
+                     btrange_t **next);
+
+/* Walk the ranges in order of address; NULL at the end */
+btrange_t *btree_first(btree_t *tree, btree_iter_t *iter);
+btrange_t *btree_next(btree_iter_t *iter);
+
+#endif /* BTREE_H */
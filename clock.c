@@ -150,3 +150,28 @@ double get_counter()
     double delta_secs = get_timer();
     return delta_secs * cpu_mhz * 1e6;
 }
+
+/* Keep track of the time stamp counter rate */
+static double tsc_hz = 0.0;
+
+double tsc_rate()
+{
+    struct timespec start, now;
+    double delta_secs;
+    uint64_t ticks;
+
+    if (tsc_hz != 0.0)
+        return tsc_hz;
+
+    /* Spin for about 20 ms, long enough to swamp the cost of the reads */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ticks = read_tsc();
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        delta_secs = 1.0 * (now.tv_sec - start.tv_sec) +
+                     1e-9 * (now.tv_nsec - start.tv_nsec);
+    } while (delta_secs < 0.02);
+    tsc_hz = (read_tsc() - ticks) / delta_secs;
+    return tsc_hz;
+}
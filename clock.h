@@ -1,5 +1,8 @@
 /* Routines for timing functions */
 
+#include <stdint.h>
+#include <time.h>
+
 /*  minimum resolution of timer (secs) */
 extern const double timer_resolution;
 
@@ -20,3 +23,19 @@ void start_counter();
 
 /* Get # cycles since counter started.  Returns 1e20 if detect timing anomaly */
 double get_counter();
+
+/* Time stamp: measures in ticks of the time stamp counter */
+/* Read the counter; cheap enough to time a single allocator call */
+static inline uint64_t read_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Get # time stamp ticks per second, measured once against the clock */
+double tsc_rate();
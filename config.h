@@ -122,6 +122,31 @@
  */
 #define ALIGNMENT 16
 
+/* Space a block of size bytes takes at the least, between aligned blocks */
+#define ALIGNED_SIZE(size) (((size) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
+
+/*
+ * Number of operations between samples of resident heap memory while
+ * measuring utilization
+ */
+#define RSS_SAMPLE_OPS 1024
+
+/*
+ * Default number of operations between rows of the time series that
+ * mdriver -o writes
+ */
+#define SERIES_INTERVAL 1000
+
+/*
+ * Bytes of a binary trace read at a time by mdriver -W
+ */
+#define STREAM_WINDOW (1 << 22)
+
+/*
+ * Maximum number of heap segments mapped with mem_map at one time
+ */
+#define MAX_SEGMENTS 4096
+
 /*********** Parameters controlling dense memory version of heap ***********/
 /*
  * Maximum heap size in bytes
@@ -133,6 +158,12 @@
  */
 #define TRY_DENSE_HEAP_START (void *) 0x800000000
 
+/*
+ * Size of a transparent huge page.  With mdriver -H, the dense heap is
+ * aligned to it, and MAX_DENSE_HEAP should be a multiple of it.
+ */
+#define HUGE_PAGE_SIZE (1<<21)  /* 2 MB */
+
 
 /*********** Parameters controlling sparse memory version of heap ***********/
 
@@ -147,14 +178,59 @@
 #define SPARSE_HEAP_START (void *) 0x2130051300000000UL
 
 /*
- * Number of bytes in each page
+ * Default number of bytes in each page (mdriver -P overrides it)
  */
 #define SPARSE_PAGE_SIZE (1<<10)
 
 /*
- * Maximum target load for hash table
+ * Pages are allocated on demand, from chunks of this many bytes
+ */
+#define SPARSE_POOL_CHUNK (8 * (1<<20))
+
+/*
+ * Initial number of buckets in the page table, which doubles whenever its
+ * load passes HASH_LOAD (must be a power of two)
  */
+#define SPARSE_MIN_BUCKETS 1024
+
+/*
+ * Number of entries in the direct-mapped software TLB that caches recent
+ * page table lookups (must be a power of two)
+ */
+#define SPARSE_TLB_SIZE 64
+
+/*
+ * Organization of the sparse page table.  By default it is open-addressed
+ * with linear probing and a power-of-two number of slots.  Define
+ * SPARSE_CHAINED as 1 to use chained buckets instead ("make membench"
+ * compares the two).
+ */
+#ifndef SPARSE_CHAINED
+#define SPARSE_CHAINED 0
+#endif
+
+/*
+ * Default maximum load for hash table: pages per bucket when chained, and
+ * the fraction of occupied slots when open-addressed (mdriver -Q overrides
+ * it)
+ */
+#if SPARSE_CHAINED
 #define HASH_LOAD 10.0
+#else
+#define HASH_LOAD 0.5
+#endif
+
+/*********** Parameters controlling the heap of libmm.so (memlib-sys.c) ******/
+
+/*
+ * Address space reserved for the heap when mm.c replaces the system malloc
+ */
+#define MAX_SYS_HEAP (1UL<<40)  /* 1 TB */
+
+/*
+ * Granularity in bytes with which reserved address space is made accessible
+ */
+#define SYS_COMMIT_CHUNK (1<<20)  /* 1 MB */
 
 /***************** Parameters for looking up reference throughput *********/
 /*
@@ -0,0 +1,84 @@
+/*
+ * Latency histograms in the style of HdrHistogram
+ *
+ * A value v at or above 2^HDR_SUB_BITS, with its highest set bit at
+ * position m, is shifted right by e = m - HDR_SUB_BITS + 1 to leave a
+ * mantissa in [HDR_SUB_HALF, 2 * HDR_SUB_HALF).  Its bucket is
+ * e * HDR_SUB_HALF + mantissa, which continues on from the exact buckets
+ * [0, 2^HDR_SUB_BITS) used for the small values.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "hdrhist.h"
+
+static int bucket_index(uint64_t value);
+static uint64_t bucket_top(int index);
+
+void hdr_reset(hdrhist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void hdr_record(hdrhist_t *h, uint64_t value)
+{
+    h->buckets[bucket_index(value)]++;
+    h->count++;
+    if (value > h->max)
+        h->max = value;
+}
+
+void hdr_add(hdrhist_t *dst, const hdrhist_t *src)
+{
+    int i;
+    for (i = 0; i < HDR_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t hdr_percentile(const hdrhist_t *h, double percentile)
+{
+    if (h->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)ceil(percentile / 100.0 * h->count);
+    if (rank < 1)
+        rank = 1;
+    if (rank >= h->count)
+        return h->max;
+
+    uint64_t seen = 0;
+    int i;
+    for (i = 0; i < HDR_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t top = bucket_top(i);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+static int bucket_index(uint64_t value)
+{
+    if (value < (1 << HDR_SUB_BITS))
+        return (int)value;
+    int msb = 63 - __builtin_clzll(value);
+    int e = msb - HDR_SUB_BITS + 1;
+    return e * HDR_SUB_HALF + (int)(value >> e);
+}
+
+/* Largest value that falls in bucket index */
+static uint64_t bucket_top(int index)
+{
+    if (index < (1 << HDR_SUB_BITS))
+        return (uint64_t)index;
+    int e = index / HDR_SUB_HALF - 1;
+    uint64_t mantissa = (uint64_t)(index - e * HDR_SUB_HALF);
+    return ((mantissa + 1) << e) - 1;
+}
@@ -0,0 +1,39 @@
+/*
+ * Latency histograms in the style of HdrHistogram
+ *
+ * Values below 2^HDR_SUB_BITS are counted exactly.  Above that, each power
+ * of two is split into 2^(HDR_SUB_BITS - 1) equal buckets, so every value
+ * is recorded with a relative error under 2^-(HDR_SUB_BITS - 1), about 6%,
+ * whatever its magnitude.  A histogram covers all 64-bit values in a fixed
+ * number of buckets and never needs resizing.
+ */
+#ifndef HDRHIST_H
+#define HDRHIST_H
+
+#include <stdint.h>
+
+#define HDR_SUB_BITS 5
+#define HDR_SUB_HALF (1 << (HDR_SUB_BITS - 1))
+#define HDR_BUCKETS ((64 - HDR_SUB_BITS + 2) * HDR_SUB_HALF)
+
+typedef struct {
+    uint64_t count;              /* Number of values recorded */
+    uint64_t max;                /* Largest value recorded, exactly */
+    uint64_t buckets[HDR_BUCKETS];
+} hdrhist_t;
+
+/* Empty the histogram */
+void hdr_reset(hdrhist_t *h);
+
+void hdr_record(hdrhist_t *h, uint64_t value);
+
+/* Add the counts of src into dst */
+void hdr_add(hdrhist_t *dst, const hdrhist_t *src);
+
+/*
+ * Smallest value that at least percentile percent of the recorded values
+ * do not exceed, rounded up to the top of its bucket.  100 gives the max.
+ */
+uint64_t hdr_percentile(const hdrhist_t *h, double percentile);
+
+#endif /* HDRHIST_H */
@@ -0,0 +1,135 @@
+/*
+ * Hash table from trace request ids to the blocks they name
+ *
+ * Ids are hashed by multiplying by 2^64 / phi and keeping the top bits,
+ * which spreads out the runs of consecutive ids that traces are made of.
+ * The table doubles when it becomes three quarters full.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "idmap.h"
+
+/* Marks an empty slot; no trace has this many ids, nor block this address */
+#define NO_ID UINT64_MAX
+
+#define MIN_SLOTS 1024
+
+static void init_slots(idmap_t *map, size_t nslots);
+static void grow(idmap_t *map);
+
+static inline size_t home(const idmap_t *map, uint64_t id)
+{
+    return (size_t)((id * 0x9E3779B97F4A7C15UL) >> map->shift);
+}
+
+idmap_t *idmap_new(void)
+{
+    idmap_t *map = malloc(sizeof(idmap_t));
+    if (!map)
+    {
+        fprintf(stderr, "ERROR.  Couldn't create id map\n");
+        exit(1);
+    }
+    init_slots(map, MIN_SLOTS);
+    return map;
+}
+
+void idmap_free(idmap_t *map)
+{
+    free(map->slots);
+    free(map);
+}
+
+identry_t *idmap_find(idmap_t *map, uint64_t id)
+{
+    size_t i;
+    for (i = home(map, id);; i = (i + 1) & map->mask)
+    {
+        if (map->slots[i].id == id)
+            return &map->slots[i];
+        if (map->slots[i].id == NO_ID)
+            return NULL;
+    }
+}
+
+identry_t *idmap_insert(idmap_t *map, uint64_t id)
+{
+    size_t i;
+    if (map->count + 1 > (map->mask + 1) / 4 * 3)
+        grow(map);
+
+    for (i = home(map, id);; i = (i + 1) & map->mask)
+    {
+        if (map->slots[i].id == id)
+            return &map->slots[i];
+        if (map->slots[i].id == NO_ID)
+            break;
+    }
+    map->slots[i].id = id;
+    map->slots[i].ptr = NULL;
+    map->slots[i].size = 0;
+    map->count++;
+    return &map->slots[i];
+}
+
+void idmap_remove(idmap_t *map, uint64_t id)
+{
+    identry_t *entry = idmap_find(map, id);
+    if (entry == NULL)
+        return;
+
+    /*
+     * Move back each entry of the run that follows, unless its home slot
+     * lies cyclically between the hole and itself, where it has to stay
+     */
+    size_t hole = entry - map->slots;
+    size_t i = hole;
+    for (;;)
+    {
+        i = (i + 1) & map->mask;
+        if (map->slots[i].id == NO_ID)
+            break;
+        size_t h = home(map, map->slots[i].id);
+        if (((i - h) & map->mask) >= ((i - hole) & map->mask))
+        {
+            map->slots[hole] = map->slots[i];
+            hole = i;
+        }
+    }
+    map->slots[hole].id = NO_ID;
+    map->count--;
+}
+
+static void init_slots(idmap_t *map, size_t nslots)
+{
+    size_t i;
+    map->slots = malloc(nslots * sizeof(identry_t));
+    if (!map->slots)
+    {
+        fprintf(stderr, "ERROR.  Couldn't grow id map to %zu slots\n",
+                nslots);
+        exit(1);
+    }
+    for (i = 0; i < nslots; i++)
+        map->slots[i].id = NO_ID;
+    map->mask = nslots - 1;
+    map->count = 0;
+    map->shift = 64 - __builtin_ctzl(nslots);
+}
+
+static void grow(idmap_t *map)
+{
+    identry_t *old = map->slots;
+    size_t nslots = map->mask + 1;
+    size_t i;
+
+    init_slots(map, 2 * nslots);
+    for (i = 0; i < nslots; i++)
+    {
+        if (old[i].id != NO_ID)
+            *idmap_insert(map, old[i].id) = old[i];
+    }
+    free(old);
+}
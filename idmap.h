@@ -0,0 +1,49 @@
+/*
+ * Hash table from trace request ids to the blocks they name
+ *
+ * The driver normally keeps arrays indexed by id, which take space in
+ * proportion to the number of ids in a trace.  This table only holds the
+ * ids that are live, so a streamed trace of any length needs space in
+ * proportion to its largest number of live blocks.  It uses open
+ * addressing with linear probing and backward-shift deletion, so there
+ * are no tombstones and lookups stay short however many ids come and go.
+ * The recorder in mm-record.c uses the same table the other way round,
+ * from the addresses of live blocks to their trace ids.
+ */
+#ifndef IDMAP_H
+#define IDMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint64_t id;
+    union
+    {
+        char *ptr;  /* Block returned by the allocator */
+        long index; /* Trace id, when the key is a block's address */
+    };
+    size_t size; /* Size that was asked for */
+} identry_t;
+
+typedef struct
+{
+    identry_t *slots;
+    size_t mask;  /* Number of slots, minus one */
+    size_t count; /* Number of ids held */
+    int shift;    /* 64 - log2(number of slots), for hashing */
+} idmap_t;
+
+idmap_t *idmap_new(void);
+void idmap_free(idmap_t *map);
+
+/* Entry for id, or NULL if there is none */
+identry_t *idmap_find(idmap_t *map, uint64_t id);
+
+/* Entry for id, added with a NULL block if there is none */
+identry_t *idmap_insert(idmap_t *map, uint64_t id);
+
+void idmap_remove(idmap_t *map, uint64_t id);
+
+#endif /* IDMAP_H */
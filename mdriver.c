@@ -7,10 +7,13 @@
  * Copyright (c) 2004-2016, R. Bryant and D. O'Hallaron, All rights
  * reserved.  May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
+#include <limits.h>
 #include <math.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -18,11 +21,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "bintrace.h"
+#include "btree.h"
+#include "clock.h"
 #include "config.h"
 #include "fcyc.h"
+#include "hdrhist.h"
+#include "idmap.h"
 #include "memlib.h"
 #include "mm.h"
 #include "stree.h"
@@ -65,41 +74,15 @@ typedef enum
  */
 
 /*
- * Records the extent of each block's payload.
- * Organized as doubly linked list
- */
-typedef struct range_t
-{
-    char *lo;   /* low payload address */
-    char *hi;   /* high payload address */
-    long index; /* same index as free; for debugging */
-    struct range_t *next;
-    struct range_t *prev;
-} range_t;
-
-/*
- * All information about set of ranges represented as doubly-linked
- * list of ranges, plus a splay tree keyed by lo addresses
+ * The extent of each block's payload, held in a B+ tree keyed by lo
+ * addresses, or with -S in a splay tree
  */
 typedef struct
 {
-    range_t *list;
+    btree_t *btree;
     tree_t *lo_tree;
 } range_set_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct
-{
-    enum
-    {
-        ALLOC,
-        FREE,
-        REALLOC
-    } type;      /* type of request */
-    long index;  /* index for free() to use later */
-    size_t size; /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file */
 typedef struct
 {
@@ -108,7 +91,7 @@ typedef struct
     int num_ids;          /* number of alloc/realloc ids */
     int num_ops;          /* number of distinct requests */
     weight_t weight;      /* weight for this trace */
-    traceop_t *ops;       /* array of requests */
+    bintrace_t bt;        /* packed requests, see bintrace.h */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     int *block_rand_base; /* index into random_data, if debug is on */
@@ -140,6 +123,12 @@ typedef struct
 
     /* defined only for the student malloc package */
     double util; /* space utilization for this trace (always 0 for libc) */
+    double reallocs;       /* number of non-trivial mm_realloc calls */
+    double realloc_copies; /* ... of which moved the block to a new address */
+    double heap_bytes;     /* peak heap size during the trace */
+    double rss_peak;       /* most heap bytes resident at any sample */
+    double rss_end;        /* heap bytes resident at the end of the trace */
+    double align_bound;    /* util with alignment as the only overhead */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -160,12 +149,15 @@ typedef struct
  * realloc and when we free.  With DBG_EXPENSIVE, we check every block
  * every operation.
  * randint_t should be a byte, in case students return unaligned memory.
+ * The first MAXFILL bytes of random data are repeated past its end, so
+ * that the data for any block is contiguous, and is copied in and
+ * compared with the memlib versions of memcpy and memcmp.
  *******************/
 #define RANDOM_DATA_LEN (1 << 16)
 
 typedef unsigned char randint_t;
 static const char randint_t_name[] = "byte";
-static randint_t random_data[RANDOM_DATA_LEN];
+static randint_t random_data[RANDOM_DATA_LEN + MAXFILL];
 
 /********************
  * Global variables
@@ -192,6 +184,28 @@ static size_t maxfill = SPARSE_MODE ? MAXFILL_SPARSE : MAXFILL;
 size_t queryGlobalSpaceUsage(void);
 #endif
 
+/* Time series of heap statistics written during eval_mm_util (-o, -i) */
+static FILE *series_file = NULL;
+static int series_interval = SERIES_INTERVAL;
+
+/*
+ * Latency histograms (-L), by type of request and by size class: up to 64
+ * bytes, then each class four times the size of the one before
+ */
+#define LATENCY_CLASSES 7
+static bool latency_mode = false;
+static hdrhist_t latency_hist[REALLOC + 1][LATENCY_CLASSES];
+static const char *latency_op_names[REALLOC + 1] = {"malloc", "free",
+                                                    "realloc"};
+static const char *latency_class_names[LATENCY_CLASSES] = {
+    "<=64", "<=256", "<=1K", "<=4K", "<=16K", "<=64K", ">64K"};
+
+/* Number of traces to check at once, in separate processes (-j) */
+static int jobs = 1;
+
+/* Check for overlapping payloads with the splay tree of stree.c (-S) */
+static bool splay_ranges = false;
+
 /* by default, no timeouts */
 static int set_timeout = 0;
 
@@ -231,6 +245,9 @@ static range_set_t *new_range_set();
 static bool add_range(range_set_t *ranges, char *lo, size_t size,
                       const trace_t *trace, int opnum, int index);
 static void remove_range(range_set_t *ranges, char *lo);
+static void reset_range_set(range_set_t *ranges);
+static bool check_usable_size(const trace_t *trace, int opnum, char *p,
+                              size_t size, size_t *usable);
 static void free_range_set(range_set_t *ranges);
 
 /* These functions implement the debugging code */
@@ -251,11 +268,20 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace);
+static void eval_mm_stream(const char *path);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printreallocs(int n, stats_t *stats);
+static void printresident(int n, stats_t *stats);
+static void printbound(int n, stats_t *stats);
+static void printlatency(void);
+static void write_series(const trace_t *trace, int opnum, size_t live_bytes);
+static void compare_hugepages(int num_tracefiles, const char *tracedir,
+                              char **tracefiles);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3, 4)));
@@ -275,6 +301,9 @@ static void timeout_handler(int sig __attribute__((unused)))
     longjmp(timeout_jmpbuf, 1);
 }
 
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats);
+
 /* Compute throughput from reference implementation */
 static double lookup_ref_throughput(bool checkpoint);
 static double measure_ref_throughput(bool checkpoint);
@@ -288,13 +317,13 @@ static void run_tests(int num_tracefiles, const char *tracedir,
                       speed_t *speed_params)
 {
     volatile int i;
+    range_set_t *ranges = new_range_set();
 
     for (i = 0; i < num_tracefiles; i++)
     {
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
         mem_init(sparse_mode);
-        range_set_t *ranges = new_range_set();
 
         // NOTE: If times out, then it will reread the trace file
 
@@ -315,11 +344,8 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             mm_stats[i].valid =
                 /* Do 2 tests, since may fail to reinitialize properly */
                 eval_mm_valid(trace, ranges);
-
-			free_range_set(ranges);
-			ranges = new_range_set();
-			mm_stats[i].valid = mm_stats[i].valid &&
-				eval_mm_valid(trace, ranges);
+            mm_stats[i].valid =
+                mm_stats[i].valid && eval_mm_valid(trace, ranges);
 
             if (onetime_flag)
             {
@@ -332,7 +358,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
@@ -340,6 +366,8 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             mm_stats[i].secs =
                 sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params);
             mm_stats[i].tput = mm_stats[i].ops / (mm_stats[i].secs * 1000.0);
+            if (latency_mode && !sparse_mode)
+                eval_mm_latency(trace);
         }
 
 #if 0
@@ -348,11 +376,216 @@ static void run_tests(int num_tracefiles, const char *tracedir,
                (double) ranges->lo_tree->comparison_count / trace->num_ops);
 #endif
         free_trace(trace);
-        free_range_set(ranges);
 
         /* clean up memory system */
         mem_deinit();
     }
+    free_range_set(ranges);
+}
+
+/*
+ * check_trace - Check a trace for correctness, twice, and then measure its
+ *     utilization.  This is the part of run_tests that depends only on the
+ *     allocator and not on the timing, and so can be run in a child.
+ */
+static void check_trace(const char *tracedir, char *tracefile, int tracenum,
+                        stats_t *stats)
+{
+    mem_init(sparse_mode);
+    range_set_t *ranges = new_range_set();
+    trace_t *trace = read_trace(stats, tracedir, tracefile);
+    strcpy(stats->filename, trace->filename);
+    stats->ops = trace->num_ops;
+
+    stats->valid = eval_mm_valid(trace, ranges);
+    stats->valid = stats->valid && eval_mm_valid(trace, ranges);
+    if (stats->valid)
+        stats->util = eval_mm_util(trace, tracenum, stats);
+
+    free_trace(trace);
+    free_range_set(ranges);
+    mem_deinit();
+}
+
+/*
+ * pin_cpu - Keep the driver on the processor it is running on, so that
+ *     the timings are not disturbed by migrations, or, if pin is false,
+ *     let it run anywhere again
+ */
+static void pin_cpu(bool pin)
+{
+    static cpu_set_t saved;
+    static bool pinned = false;
+    cpu_set_t set;
+
+    if (pin && sched_getaffinity(0, sizeof(saved), &saved) == 0)
+    {
+        CPU_ZERO(&set);
+        CPU_SET(sched_getcpu(), &set);
+        pinned = sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+    else if (!pin && pinned)
+    {
+        sched_setaffinity(0, sizeof(saved), &saved);
+        pinned = false;
+    }
+}
+
+/*
+ * run_tests_parallel - Like run_tests, but check up to "jobs" traces at
+ *     once, each in a process of its own, since mm.c and memlib.c keep
+ *     their state in globals.  Each child sends its stats_t back through a
+ *     pipe.  The throughput of the valid traces is then measured one trace
+ *     at a time, with no children running and the driver pinned to one
+ *     processor.  Rows of the -o time series of different traces may come
+ *     out interleaved.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats)
+{
+    pid_t *pids;
+    int *fds;
+    volatile int next = 0, running = 0;
+    volatile int i;
+    speed_t speed_params;
+
+    if ((pids = calloc(num_tracefiles, sizeof(*pids))) == NULL ||
+        (fds = calloc(num_tracefiles, sizeof(*fds))) == NULL)
+        unix_error("calloc in run_tests_parallel failed");
+
+    /* Whole rows only, as the children share the file */
+    if (series_file != NULL)
+        setvbuf(series_file, NULL, _IOLBF, 0);
+
+    if (setjmp(timeout_jmpbuf) != 0)
+    {
+        /* Give up on the traces still being checked or timed */
+        for (i = 0; i < num_tracefiles; i++)
+        {
+            if (pids[i] > 0)
+                kill(pids[i], SIGKILL);
+            if (mm_stats[i].secs == 0)
+                mm_stats[i].valid = false;
+        }
+        while (wait(NULL) > 0)
+            ;
+        free(pids);
+        free(fds);
+        pin_cpu(false);
+        return;
+    }
+
+    while (next < num_tracefiles || running > 0)
+    {
+        while (running < jobs && next < num_tracefiles)
+        {
+            int pipefd[2];
+            if (pipe(pipefd) != 0)
+                unix_error("pipe in run_tests_parallel failed");
+            fflush(NULL);
+            if ((pids[next] = fork()) < 0)
+                unix_error("fork in run_tests_parallel failed");
+            if (pids[next] == 0)
+            {
+                /* Child: a stats_t is well under PIPE_BUF, so one write */
+                close(pipefd[0]);
+                errors = 0;
+                check_trace(tracedir, tracefiles[next], next,
+                            &mm_stats[next]);
+                if (write(pipefd[1], &mm_stats[next], sizeof(stats_t)) !=
+                    sizeof(stats_t))
+                    unix_error("write in run_tests_parallel failed");
+                fflush(NULL);
+                _exit(errors > 255 ? 255 : errors);
+            }
+            close(pipefd[1]);
+            fds[next] = pipefd[0];
+            next++;
+            running++;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+            unix_error("wait in run_tests_parallel failed");
+        for (i = 0; i < num_tracefiles && pids[i] != pid; i++)
+            ;
+        if (i == num_tracefiles)
+            continue;
+        running--;
+        pids[i] = 0;
+
+        /* A child that exited without its stats hit a fatal problem */
+        if (read(fds[i], &mm_stats[i], sizeof(stats_t)) != sizeof(stats_t) ||
+            !WIFEXITED(status))
+            app_error("Checking %s failed in a child process\n",
+                      tracefiles[i]);
+        close(fds[i]);
+        errors += WEXITSTATUS(status);
+    }
+
+    pin_cpu(true);
+    for (i = 0; i < num_tracefiles; i++)
+    {
+        if (!mm_stats[i].valid)
+            continue;
+        mem_init(sparse_mode);
+        stats_t stats;
+        trace_t *trace = read_trace(&stats, tracedir, tracefiles[i]);
+        speed_params.trace = trace;
+        speed_params.ranges = NULL;
+        if (verbose > 1)
+            printf("Measuring the performance of %s.\n", trace->filename);
+        mm_stats[i].secs =
+            sparse_mode ? 1.0 : fsec(eval_mm_speed, &speed_params);
+        mm_stats[i].tput = mm_stats[i].ops / (mm_stats[i].secs * 1000.0);
+        if (latency_mode && !sparse_mode)
+            eval_mm_latency(trace);
+        free_trace(trace);
+        mem_deinit();
+    }
+    pin_cpu(false);
+    free(pids);
+    free(fds);
+}
+
+/*
+ * compare_hugepages - Time each trace with the heap on regular pages and
+ *     then on transparent huge pages, and print the two throughputs.
+ *     Heaps that span many pages see the most dTLB misses, so the large
+ *     traces benefit most.
+ */
+static void compare_hugepages(int num_tracefiles, const char *tracedir,
+                              char **tracefiles)
+{
+    int i, thp;
+    stats_t stats;
+    speed_t speed_params;
+    double tput[2];
+
+    if (sparse_mode)
+        app_error("Huge pages only apply to the dense heap");
+
+    printf("\n  %10s%10s%10s  %s\n", "4K Kops", "THP Kops", "speedup",
+           "trace");
+    for (i = 0; i < num_tracefiles; i++)
+    {
+        trace_t *trace = read_trace(&stats, tracedir, tracefiles[i]);
+        speed_params.trace = trace;
+        speed_params.ranges = NULL;
+        for (thp = 0; thp < 2; thp++)
+        {
+            mem_set_hugepages(thp);
+            mem_init(false);
+            double secs = fsec(eval_mm_speed, &speed_params);
+            tput[thp] = trace->num_ops / (secs * 1000.0);
+            mem_deinit();
+        }
+        printf("  %10.0f%10.0f%10.3f  %s\n", tput[0], tput[1],
+               tput[1] / tput[0], trace->filename);
+        free_trace(trace);
+    }
+    mem_set_hugepages(false);
 }
 
 /**************
@@ -378,13 +611,21 @@ int main(int argc, char **argv)
     double min_throughput = -1;
     double max_throughput = -1;
 
+    bool thp_compare = false; /* if set, time traces with THP off and on */
+    char *stream_path = NULL; /* binary trace to replay as it is read */
+
+    /* Sparse emulation parameters; 0 keeps the memlib.c defaults */
+    size_t sparse_page_size = 0;
+    size_t sparse_max_pages = 0;
+    double sparse_hash_load = 0.0;
+
 #if !REF_ONLY
 
     char c;
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpCOVAlDT")) != EOF)
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpCOVAlDTP:M:Q:HBi:o:LW:j:S")) != EOF)
     {
         switch (c)
         {
@@ -445,6 +686,60 @@ int main(int argc, char **argv)
             tab_mode = true;
             break;
 
+        case 'P': /* Page size for sparse emulation */
+            sparse_page_size = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'M': /* Maximum number of pages for sparse emulation */
+            sparse_max_pages = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'Q': /* Maximum load of the sparse page table */
+            sparse_hash_load = atof(optarg);
+            break;
+
+        case 'H': /* Back the heap with transparent huge pages */
+            mem_set_hugepages(true);
+            break;
+
+        case 'B': /* Compare throughput without and with huge pages */
+            thp_compare = true;
+            break;
+
+        case 'j': /* Check this many traces at once */
+            jobs = atoi(optarg);
+            if (jobs <= 0)
+                app_error("The number of jobs given to -j must be positive");
+            break;
+
+        case 'S': /* Keep the ranges of payloads in the splay tree */
+            splay_ranges = true;
+            break;
+
+        case 'W': /* Stream a binary trace instead of loading it */
+            stream_path = optarg;
+            break;
+
+        case 'L': /* Time each request and print latency percentiles */
+            latency_mode = true;
+            break;
+
+        case 'i': /* Operations between rows of the time series */
+            series_interval = atoi(optarg);
+            if (series_interval <= 0)
+                app_error("The interval given to -i must be positive");
+            break;
+
+        case 'o': /* Write a time series of heap statistics to a file */
+            if (series_file != NULL)
+                fclose(series_file);
+            if ((series_file = fopen(optarg, "w")) == NULL)
+                unix_error("Could not open %s for writing", optarg);
+            fprintf(series_file, "trace,op,live_bytes,heap_bytes,"
+                                 "peak_heap_bytes,resident_bytes,"
+                                 "free_blocks,free_bytes,largest_free\n");
+            break;
+
         case 'h': /* Print this message */
             usage(argv[0]);
             exit(0);
@@ -456,6 +751,10 @@ int main(int argc, char **argv)
     }
 #endif /* !REF_ONLY */
 
+    if (!mem_config_sparse(sparse_page_size, sparse_max_pages,
+                           sparse_hash_load))
+        app_error("Invalid sparse emulation parameters (-P, -M or -Q)");
+
     if (num_global_tracefiles == 0)
     {
         int i;
@@ -473,6 +772,18 @@ int main(int argc, char **argv)
         init_random_data();
     }
 
+    if (thp_compare)
+    {
+        compare_hugepages(num_global_tracefiles, tracedir, global_tracefiles);
+        exit(0);
+    }
+
+    if (stream_path != NULL)
+    {
+        eval_mm_stream(stream_path);
+        exit(0);
+    }
+
     /* Initialize the timeout */
     if (set_timeout > 0)
     {
@@ -547,13 +858,20 @@ int main(int argc, char **argv)
     if (verbose > 1)
         printf("\nTesting mm malloc\n");
 
+    /* Report how much memory the sparse heap emulation used */
+    mem_set_show_stats(sparse_mode && verbose > 1);
+
     /* Allocate the mm stats array, with one stats_t struct per tracefile */
     mm_stats = (stats_t *)calloc(num_global_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
-    run_tests(num_global_tracefiles, tracedir, global_tracefiles, mm_stats,
-              &speed_params);
+    if (jobs > 1 && !onetime_flag)
+        run_tests_parallel(num_global_tracefiles, tracedir,
+                           global_tracefiles, mm_stats);
+    else
+        run_tests(num_global_tracefiles, tracedir, global_tracefiles,
+                  mm_stats, &speed_params);
 
     /* Display the mm results in a compact table */
     if (verbose)
@@ -577,6 +895,11 @@ int main(int argc, char **argv)
         {
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
+            printreallocs(num_global_tracefiles, mm_stats);
+            printresident(num_global_tracefiles, mm_stats);
+            printbound(num_global_tracefiles, mm_stats);
+            if (latency_mode && !sparse_mode)
+                printlatency();
             printf("\n");
         }
     }
@@ -775,8 +1098,8 @@ static void add_tracefile(char *trace)
 static range_set_t *new_range_set()
 {
     range_set_t *ranges = (range_set_t *)malloc(sizeof(range_set_t));
-    ranges->list = NULL;
-    ranges->lo_tree = tree_new();
+    ranges->lo_tree = splay_ranges ? tree_new() : NULL;
+    ranges->btree = splay_ranges ? NULL : btree_new();
     return ranges;
 }
 
@@ -802,9 +1125,8 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))
+    /* The payload must lie within the brk heap or a single segment */
+    if (!mem_is_heap(lo, hi - lo + 1))
     {
         malloc_error(trace, opnum, "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -816,43 +1138,59 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
     if (debug_mode == DBG_NONE)
         return 1;
 
-    /* Look in the tree for the predecessor block */
-    range_t *prev = tree_find_nearest(ranges->lo_tree, (long unsigned)lo);
-    range_t *next = prev ? prev->next : NULL;
-    /* See if it overlaps previous or next blocks */
-    if (prev && lo <= prev->hi)
+    if (ranges->btree != NULL)
+    {
+        btrange_t *below, *above;
+        btree_neighbors(ranges->btree, (uintptr_t)lo, &below, &above);
+        if (below && lo <= (char *)below->hi)
+        {
+            malloc_error(trace, opnum,
+                         "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                         lo, hi, (char *)below->lo, (char *)below->hi);
+            return false;
+        }
+        if (above && hi >= (char *)above->lo)
+        {
+            malloc_error(trace, opnum,
+                         "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                         lo, hi, (char *)above->lo, (char *)above->hi);
+            return false;
+        }
+        btree_insert(ranges->btree, (uintptr_t)lo, (uintptr_t)hi, index);
+        return true;
+    }
+
+    /* See if it overlaps any block in the tree */
+    trange_t *r = tree_range_overlaps(ranges->lo_tree, (long)lo, (long)hi);
+    if (r)
     {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) overlaps another payload (%p:%p)\n", lo,
-                     hi, prev->lo, prev->hi);
+                     hi, (char *)r->lo, (char *)r->hi);
         return false;
     }
-    if (next && hi >= next->lo)
+    /* Everything looks OK, so remember the extent of this block */
+    tree_insert(ranges->lo_tree, (long)lo, (long)hi, index);
+    return true;
+}
+
+/*
+ * check_usable_size - As directed by request opnum, we've just been given
+ *     a block of at least size bytes at addr p.  Check that mm_usable_size
+ *     reports at least that much, and return its value in *usable.
+ */
+static bool check_usable_size(const trace_t *trace, int opnum, char *p,
+                              size_t size, size_t *usable)
+{
+    *usable = mm_usable_size(p);
+    if (*usable < size)
     {
         malloc_error(trace, opnum,
-                     "Payload (%p:%p) overlaps another payload (%p:%p)\n", lo,
-                     hi, next->lo, next->hi);
+                     "mm_usable_size (%zu) of payload %p is less than the "
+                     "requested size (%zu)",
+                     *usable, p, size);
         return false;
     }
-    /*
-     * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
-     */
-    range_t *p;
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-        unix_error("malloc error in add_range");
-    p->prev = prev;
-    if (prev)
-        prev->next = p;
-    else
-        ranges->list = p;
-    p->next = next;
-    if (next)
-        next->prev = p;
-    p->lo = lo;
-    p->hi = hi;
-    p->index = index;
-    tree_insert(ranges->lo_tree, (long unsigned)lo, (void *)p);
     return true;
 }
 
@@ -861,26 +1199,33 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
  */
 static void remove_range(range_set_t *ranges, char *lo)
 {
-    range_t *p = (range_t *)tree_remove(ranges->lo_tree, (long unsigned)lo);
-    if (!p)
-        return;
-    range_t *prev = p->prev;
-    range_t *next = p->next;
-    if (prev)
-        prev->next = next;
+    if (ranges->btree != NULL)
+        btree_remove(ranges->btree, (uintptr_t)lo);
     else
-        ranges->list = next;
-    if (next)
-        next->prev = prev;
-    free(p);
+        tree_remove(ranges->lo_tree, (long)lo);
 }
 
 /*
- * free_range_set - free all of the range records for a trace
+ * reset_range_set - forget every range, keeping the space for the next
+ *     pass over a trace
+ */
+static void reset_range_set(range_set_t *ranges)
+{
+    if (ranges->btree != NULL)
+        btree_reset(ranges->btree);
+    else
+        tree_reset(ranges->lo_tree);
+}
+
+/*
+ * free_range_set - free the range set and all of its records
  */
 static void free_range_set(range_set_t *ranges)
 {
-    tree_free(ranges->lo_tree, free);
+    if (ranges->btree != NULL)
+        btree_free(ranges->btree);
+    else
+        tree_free(ranges->lo_tree);
     free(ranges);
 }
 
@@ -900,19 +1245,19 @@ static void init_random_data(void)
     {
         random_data[len] = random();
     }
+    memcpy(&random_data[RANDOM_DATA_LEN], random_data, MAXFILL);
 }
 
 static void randomize_block(trace_t *traces, int index)
 {
     size_t size, fsize;
-    size_t i;
     randint_t *block;
     int base;
 
     if (debug_mode == DBG_NONE)
         return;
 
-    traces->block_rand_base[index] = random();
+    traces->block_rand_base[index] = random() % RANDOM_DATA_LEN;
 
     block = (randint_t *)traces->blocks[index];
     size = traces->block_sizes[index] / sizeof(*block);
@@ -923,16 +1268,10 @@ static void randomize_block(trace_t *traces, int index)
         fsize = maxfill;
     base = traces->block_rand_base[index];
 
-    // NOTE: It's expensive to do this one byte at a time.
-
     // NOTE: It would be nice to also fill in at end of block, but
     // this gets messy with REALLOC
 
-    for (i = 0; i < fsize; i++)
-    {
-        mem_write(&block[i], random_data[(base + i) % RANDOM_DATA_LEN],
-                  sizeof(randint_t));
-    }
+    mem_memcpy(block, &random_data[base], fsize * sizeof(randint_t));
 }
 
 static bool check_index(const trace_t *trace, int opnum, int index)
@@ -961,12 +1300,14 @@ static bool check_index(const trace_t *trace, int opnum, int index)
 
     base = trace->block_rand_base[index];
 
-    // NOTE: It's expensive to do this one byte at a time.
     setUBCheck(false);
-    for (i = 0; i < fsize; i++)
+    bool intact =
+        mem_memcmp(block, &random_data[base], fsize * sizeof(randint_t)) == 0;
+
+    /* Only go a byte at a time to describe the damage */
+    for (i = 0; !intact && i < fsize; i++)
     {
-        if (mem_read(&block[i], sizeof(randint_t)) !=
-            random_data[(base + i) % RANDOM_DATA_LEN])
+        if (mem_read(&block[i], sizeof(randint_t)) != random_data[base + i])
         {
             if (firstgarbled == -1)
                 firstgarbled = i;
@@ -997,14 +1338,8 @@ static bool check_index(const trace_t *trace, int opnum, int index)
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    int index;
-    size_t size;
-    int max_index = 0;
-    int op_index;
-    int ignore = 0;
+    const char *msg;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -1013,30 +1348,24 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((trace = (trace_t *)malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trace");
 
-    /* Read the trace file header */
+    /* Map the trace, either binary or .rep, and pack its requests */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
-    if ((tracefile = fopen(trace->filename, "r")) == NULL)
-    {
-        unix_error("Could not open %s in read_trace", trace->filename);
-    }
-    int iweight;
-    ignore += fscanf(tracefile, "%d", &iweight);
-    trace->weight = iweight;
-    ignore += fscanf(tracefile, "%d", &trace->num_ids);
-    ignore += fscanf(tracefile, "%d", &trace->num_ops);
-    ignore += fscanf(tracefile, "%zd", &trace->data_bytes);
+    if ((msg = bt_open(&trace->bt, trace->filename)) != NULL)
+        app_error("Could not read %s in read_trace: %s\n", trace->filename,
+                  msg);
+    if (trace->bt.num_ids > INT_MAX || trace->bt.num_ops > INT_MAX)
+        app_error("%s: too many requests\n", trace->filename);
+    trace->weight = trace->bt.weight;
+    trace->num_ids = (int)trace->bt.num_ids;
+    trace->num_ops = (int)trace->bt.num_ops;
+    trace->data_bytes = trace->bt.data_bytes;
 
     if (trace->weight > 3)
     {
         app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
     }
 
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-             (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
-
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = (char **)calloc(trace->num_ids, sizeof(char *))) ==
         NULL)
@@ -1052,44 +1381,6 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
              calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
         unix_error("malloc 5 failed in read_trace");
 
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF)
-    {
-        switch (type[0])
-        {
-        case 'a':
-            ignore += fscanf(tracefile, "%u %lu", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'r':
-            ignore += fscanf(tracefile, "%u %lu", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            ignore += fscanf(tracefile, "%u", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-            break;
-        default:
-            app_error("Bogus type character (%c) in tracefile %s\n", type[0],
-                      trace->filename);
-        }
-        op_index++;
-        if (op_index == trace->num_ops)
-            break;
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
@@ -1109,12 +1400,13 @@ static void reinit_trace(trace_t *trace)
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ * free_trace - Free the trace record, the three arrays it points to,
+ *              all of which were allocated in read_trace(), and the
+ *              requests themselves.
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops); /* free the three arrays... */
+    bt_close(&trace->bt); /* free the requests... */
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
@@ -1126,14 +1418,35 @@ static void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/* What check_range needs, as it is called by tree_for_each */
+typedef struct
+{
+    const trace_t *trace;
+    int opnum;
+    bool ok;
+} range_check_t;
+
+/*
+ * check_range - Check the data of the block whose payload is r
+ */
+static void check_range(trange_t *r, void *arg)
+{
+    range_check_t *check = arg;
+    if (!check_index(check->trace, check->opnum, r->index))
+        check->ok = false;
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 {
     int i;
+    bt_cursor_t cursor;
+    traceop_t op;
     int index;
     size_t size;
+    size_t usable;
     char *newp;
     char *oldp;
     char *p;
@@ -1142,6 +1455,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
     reinit_trace(trace);
+    reset_range_set(ranges);
 
     /* Call the mm package's init function */
     if (!mm_init())
@@ -1151,15 +1465,14 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0; i < trace->num_ops; i++)
+    bt_rewind(&trace->bt, &cursor);
+    for (i = 0; bt_next(&cursor, &op); i++)
     {
-        index = trace->ops[i].index;
-        size = trace->ops[i].size;
+        index = op.index;
+        size = op.size;
 
         if (debug_mode == DBG_EXPENSIVE)
         {
-            range_t *r;
-
             /* Let the students check their own heap */
             if (!mm_checkheap(0))
             {
@@ -1168,18 +1481,26 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             };
 
             /* Now check that all our allocated blocks have the right data */
-            r = ranges->list;
-            while (r)
+            if (ranges->btree != NULL)
             {
-                if (!check_index(trace, i, r->index))
+                btree_iter_t iter;
+                btrange_t *b;
+                for (b = btree_first(ranges->btree, &iter); b != NULL;
+                     b = btree_next(&iter))
                 {
-                    allCheck = false;
+                    if (!check_index(trace, i, b->index))
+                        allCheck = false;
                 }
-                r = r->next;
+            }
+            else
+            {
+                range_check_t check = {trace, i, true};
+                tree_for_each(ranges->lo_tree, check_range, &check);
+                allCheck = allCheck && check.ok;
             }
         }
 
-        switch (trace->ops[i].type)
+        switch (op.type)
         {
 
         case ALLOC: /* mm_malloc */
@@ -1194,9 +1515,11 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             /*
              * Test the range of the new block for correctness and add it
              * to the range list if OK. The block must be  be aligned properly,
-             * and must not overlap any currently allocated block.
+             * and must not overlap any currently allocated block.  The whole
+             * usable size counts, since callers are allowed to use it.
              */
-            if (add_range(ranges, p, size, trace, i, index) == 0)
+            if (!check_usable_size(trace, i, p, size, &usable) ||
+                add_range(ranges, p, usable, trace, i, index) == 0)
                 return false;
 
             /* Remember region */
@@ -1237,7 +1560,8 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             /* Check new block for correctness and add it to range list */
             if (size > 0)
             {
-                if (add_range(ranges, newp, size, trace, i, index) == 0)
+                if (!check_usable_size(trace, i, newp, size, &usable) ||
+                    add_range(ranges, newp, usable, trace, i, index) == 0)
                     return false;
             }
 
@@ -1293,38 +1617,49 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   peak size of the heap in bytes while running the student's malloc
+ *   package on the trace. mem_sbrk() doesn't allow the students to
+ *   decrement the brk pointer, but segments from mem_map() can be
+ *   unmapped, so the heap size at the end need not be its peak.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
     int i;
+    bt_cursor_t cursor;
+    traceop_t op;
     int index;
     size_t size, newsize, oldsize;
     size_t max_total_size = 0;
     size_t total_size = 0;
+    size_t max_aligned_size = 0;
+    size_t aligned_size = 0;
     char *p;
     char *newp, *oldp;
 
     reinit_trace(trace);
-
-    /* initialize the heap and the mm malloc package */
+    stats->reallocs = 0;
+    stats->realloc_copies = 0;
+    stats->rss_peak = 0;
+
+    /* initialize the heap and the mm malloc package.  Drop the pages left
+     * resident by earlier passes, so that only this one is measured */
+    mem_decommit(mem_heap_lo(),
+                 (char *)mem_heap_hi() + 1 - (char *)mem_heap_lo());
     mem_reset_brk();
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
-    for (i = 0; i < trace->num_ops; i++)
+    bt_rewind(&trace->bt, &cursor);
+    for (i = 0; bt_next(&cursor, &op); i++)
     {
-        switch (trace->ops[i].type)
+        switch (op.type)
         {
 
         case ALLOC: /* mm_alloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op.index;
+            size = op.size;
 
             if ((p = mm_malloc(size)) == NULL)
             {
@@ -1337,11 +1672,12 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             trace->block_sizes[index] = size;
 
             total_size += size;
+            aligned_size += ALIGNED_SIZE(size);
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = op.index;
+            newsize = op.size;
             oldsize = trace->block_sizes[index];
 
             oldp = trace->blocks[index];
@@ -1353,15 +1689,24 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             }
             setUBCheck(true);
 
+            /* Count the reallocs that had to move the block */
+            if (oldp != NULL && newsize != 0)
+            {
+                stats->reallocs++;
+                if (newp != oldp)
+                    stats->realloc_copies++;
+            }
+
             /* Remember region and size */
             trace->blocks[index] = newp;
             trace->block_sizes[index] = newsize;
 
             total_size += (newsize - oldsize);
+            aligned_size += ALIGNED_SIZE(newsize) - ALIGNED_SIZE(oldsize);
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op.index;
             if (index < 0)
             {
                 size = 0;
@@ -1376,6 +1721,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             mm_free(p);
 
             total_size -= size;
+            aligned_size -= ALIGNED_SIZE(size);
             break;
 
         default:
@@ -1386,13 +1732,50 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size =
             (total_size > max_total_size) ? total_size : max_total_size;
+        if (aligned_size > max_aligned_size)
+            max_aligned_size = aligned_size;
+
+        if (i % RSS_SAMPLE_OPS == 0)
+        {
+            double rss = mem_resident_bytes();
+            if (rss > stats->rss_peak)
+                stats->rss_peak = rss;
+        }
+
+        if (series_file != NULL &&
+            (i % series_interval == 0 || i == trace->num_ops - 1))
+            write_series(trace, i, total_size);
     }
 
+    stats->heap_bytes = mem_peak_heapsize();
+    stats->align_bound =
+        max_aligned_size > 0 ? (double)max_total_size / max_aligned_size : 1;
+    stats->rss_end = mem_resident_bytes();
+    if (stats->rss_end > stats->rss_peak)
+        stats->rss_peak = stats->rss_end;
+
 #if !REF_ONLY
     printf(".");
 #endif
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
+}
+
+/*
+ * write_series - Append one row of the -o time series, taken after
+ *     operation opnum of the trace.  Averages over a whole trace hide
+ *     short bursts of fragmentation, which these rows show.
+ */
+static void write_series(const trace_t *trace, int opnum, size_t live_bytes)
+{
+    mm_heapstats_t hs;
+    if (!mm_heapstats(&hs))
+        hs.free_blocks = hs.free_bytes = hs.largest_free = 0;
+
+    fprintf(series_file, "%s,%d,%zu,%zu,%zu,%zu,%zu,%zu,%zu\n",
+            trace->filename, opnum, live_bytes, mem_heapsize(),
+            mem_peak_heapsize(), mem_resident_bytes(), hs.free_blocks,
+            hs.free_bytes, hs.largest_free);
 }
 
 /*
@@ -1402,6 +1785,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 static void eval_mm_speed(void *ptr)
 {
     int i, index;
+    bt_cursor_t cursor;
+    traceop_t op;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -1413,21 +1798,22 @@ static void eval_mm_speed(void *ptr)
         app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0; i < trace->num_ops; i++)
-        switch (trace->ops[i].type)
+    bt_rewind(&trace->bt, &cursor);
+    for (i = 0; bt_next(&cursor, &op); i++)
+        switch (op.type)
         {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op.index;
+            size = op.size;
             if ((p = mm_malloc(size)) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = op.index;
+            newsize = op.size;
             oldp = trace->blocks[index];
             setUBCheck(false);
             if ((newp = mm_realloc(oldp, newsize)) == NULL && newsize != 0)
@@ -1437,7 +1823,7 @@ static void eval_mm_speed(void *ptr)
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op.index;
             if (index < 0)
             {
                 block = 0;
@@ -1454,6 +1840,202 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * latency_class - Size class of a request for the latency histograms
+ */
+static int latency_class(size_t size)
+{
+    int class = 0;
+    size_t limit = 64;
+    while (class < LATENCY_CLASSES - 1 && size > limit)
+    {
+        limit *= 4;
+        class++;
+    }
+    return class;
+}
+
+/*
+ * eval_mm_latency - Replay the trace once, timing each request with the
+ *    time stamp counter, and add the times to latency_hist.  fcyc only
+ *    gives the time of a whole replay, which hides the slow requests.
+ *    The cost of reading the counter twice is taken off each sample.
+ */
+static void eval_mm_latency(trace_t *trace)
+{
+    int i, index;
+    bt_cursor_t cursor;
+    traceop_t op;
+    size_t size;
+    char *p;
+    uint64_t start, ticks, overhead;
+
+    /* The cheapest of a few back to back reads is the timing overhead */
+    overhead = UINT64_MAX;
+    for (i = 0; i < 100; i++)
+    {
+        start = read_tsc();
+        ticks = read_tsc() - start;
+        if (ticks < overhead)
+            overhead = ticks;
+    }
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_latency");
+
+    bt_rewind(&trace->bt, &cursor);
+    for (i = 0; bt_next(&cursor, &op); i++)
+    {
+        index = op.index;
+        switch (op.type)
+        {
+
+        case ALLOC: /* mm_malloc */
+            size = op.size;
+            start = read_tsc();
+            p = mm_malloc(size);
+            ticks = read_tsc() - start;
+            if (p == NULL)
+                app_error("mm_malloc failed in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            size = op.size;
+            setUBCheck(false);
+            start = read_tsc();
+            p = mm_realloc(trace->blocks[index], size);
+            ticks = read_tsc() - start;
+            setUBCheck(true);
+            if (p == NULL && size != 0)
+                app_error("mm_realloc failed in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* mm_free, counted under the size of the block */
+            p = index < 0 ? NULL : trace->blocks[index];
+            size = index < 0 ? 0 : trace->block_sizes[index];
+            start = read_tsc();
+            mm_free(p);
+            ticks = read_tsc() - start;
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_latency");
+        }
+
+        ticks = ticks > overhead ? ticks - overhead : 0;
+        hdr_record(&latency_hist[op.type][latency_class(size)],
+                   ticks);
+    }
+}
+
+/*
+ * eval_mm_stream - Replay a binary trace while it is being read, keeping
+ *    only the live blocks in an idmap_t, so that neither the requests nor
+ *    arrays sized by the number of ids have to fit in memory.  The replay
+ *    is only checked for blocks that are misaligned or outside the heap,
+ *    and is timed once, decoding and id lookups included.
+ */
+static void eval_mm_stream(const char *path)
+{
+    bt_stream_t st;
+    traceop_t op;
+    idmap_t *map;
+    identry_t *entry;
+    const char *msg;
+    unsigned long opnum = 0;
+    size_t live_bytes = 0, peak_bytes = 0;
+    size_t peak_ids = 0;
+    double secs;
+    char *p;
+
+    if ((msg = bt_stream_open(&st, path, STREAM_WINDOW)) != NULL)
+        app_error("Could not read %s: %s\n", path, msg);
+    map = idmap_new();
+    mem_init(sparse_mode);
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_stream\n");
+
+    start_timer();
+    while (bt_stream_next(&st, &op))
+    {
+        switch (op.type)
+        {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(op.size)) == NULL)
+                app_error("%s: mm_malloc failed at request %lu\n", path,
+                          opnum);
+            entry = idmap_insert(map, op.index);
+            entry->ptr = p;
+            entry->size = op.size;
+            live_bytes += op.size;
+            break;
+
+        case REALLOC: /* mm_realloc, of NULL if the id is not live */
+            entry = idmap_insert(map, op.index);
+            setUBCheck(false);
+            p = mm_realloc(entry->ptr, op.size);
+            setUBCheck(true);
+            if (p == NULL && op.size != 0)
+                app_error("%s: mm_realloc failed at request %lu\n", path,
+                          opnum);
+            live_bytes += op.size - entry->size;
+            if (op.size == 0)
+            {
+                /* Resizing to nothing frees the block */
+                idmap_remove(map, op.index);
+                break;
+            }
+            entry->ptr = p;
+            entry->size = op.size;
+            break;
+
+        default: /* mm_free */
+            p = NULL;
+            entry = op.index < 0 ? NULL : idmap_find(map, op.index);
+            if (entry == NULL)
+            {
+                mm_free(NULL);
+                break;
+            }
+            mm_free(entry->ptr);
+            live_bytes -= entry->size;
+            idmap_remove(map, op.index);
+            break;
+        }
+
+        if (p != NULL && ((uintptr_t)p % ALIGNMENT != 0 ||
+                          !mem_is_heap(p, op.size > 0 ? op.size : 1)))
+            app_error("%s: block %p of request %lu is misaligned or outside "
+                      "the heap\n",
+                      path, (void *)p, opnum);
+        if (live_bytes > peak_bytes)
+            peak_bytes = live_bytes;
+        if (map->count > peak_ids)
+            peak_ids = map->count;
+        opnum++;
+    }
+    secs = get_timer();
+    if (st.error != NULL)
+        app_error("%s: %s after request %lu\n", path, st.error, opnum);
+
+    printf("\n  %8s%12s%10s%10s%12s  %s\n", "util", "ops", "secs",
+           "Kops/s", "live ids", "trace");
+    printf("  %7.1f%%%12lu%10.3f%10.0f%12zu  %s\n",
+           100.0 * peak_bytes / mem_peak_heapsize(), opnum, secs,
+           opnum / (secs * 1000.0), peak_ids, path);
+
+    idmap_free(map);
+    bt_stream_close(&st);
+    mem_deinit();
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1463,40 +2045,43 @@ static void eval_mm_speed(void *ptr)
 static bool eval_libc_valid(trace_t *trace)
 {
     int i;
+    bt_cursor_t cursor;
+    traceop_t op;
     size_t newsize;
     char *p, *newp, *oldp;
 
     reinit_trace(trace);
 
-    for (i = 0; i < trace->num_ops; i++)
+    bt_rewind(&trace->bt, &cursor);
+    for (i = 0; bt_next(&cursor, &op); i++)
     {
-        switch (trace->ops[i].type)
+        switch (op.type)
         {
 
         case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL)
+            if ((p = malloc(op.size)) == NULL)
             {
                 malloc_error(trace, i, "libc malloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = p;
+            trace->blocks[op.index] = p;
             break;
 
         case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[trace->ops[i].index];
+            newsize = op.size;
+            oldp = trace->blocks[op.index];
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
             {
                 malloc_error(trace, i, "libc realloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = newp;
+            trace->blocks[op.index] = newp;
             break;
 
         case FREE: /* free */
-            if (trace->ops[i].index >= 0)
+            if (op.index >= 0)
             {
-                free(trace->blocks[trace->ops[i].index]);
+                free(trace->blocks[op.index]);
             }
             else
             {
@@ -1520,6 +2105,8 @@ static bool eval_libc_valid(trace_t *trace)
 static void eval_libc_speed(void *ptr)
 {
     int i;
+    bt_cursor_t cursor;
+    traceop_t op;
     int index;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
@@ -1527,21 +2114,22 @@ static void eval_libc_speed(void *ptr)
 
     reinit_trace(trace);
 
-    for (i = 0; i < trace->num_ops; i++)
+    bt_rewind(&trace->bt, &cursor);
+    for (i = 0; bt_next(&cursor, &op); i++)
     {
-        switch (trace->ops[i].type)
+        switch (op.type)
         {
         case ALLOC: /* malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op.index;
+            size = op.size;
             if ((p = malloc(size)) == NULL)
                 unix_error("malloc failed in eval_libc_speed");
             trace->blocks[index] = p;
             break;
 
         case REALLOC: /* realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = op.index;
+            newsize = op.size;
             oldp = trace->blocks[index];
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
                 unix_error("realloc failed in eval_libc_speed\n");
@@ -1550,7 +2138,7 @@ static void eval_libc_speed(void *ptr)
             break;
 
         case FREE: /* free */
-            index = trace->ops[i].index;
+            index = op.index;
             if (index >= 0)
             {
                 block = trace->blocks[index];
@@ -1747,6 +2335,129 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+/*
+ * printreallocs - Print how often mm_realloc had to move a block, for the
+ *     traces that realloc at all
+ */
+static void printreallocs(int n, stats_t *stats)
+{
+    int i;
+    double sumreallocs = 0;
+    double sumcopies = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        if (stats[i].valid && stats[i].reallocs > 0)
+        {
+            if (sumreallocs == 0)
+                printf("\n  %10s%10s%10s  %s\n", "reallocs", "copies",
+                       "copies/r", "trace");
+            printf("  %10.0f%10.0f%10.3f  %s\n", stats[i].reallocs,
+                   stats[i].realloc_copies,
+                   stats[i].realloc_copies / stats[i].reallocs,
+                   stats[i].filename);
+            sumreallocs += stats[i].reallocs;
+            sumcopies += stats[i].realloc_copies;
+        }
+    }
+    if (sumreallocs > 0)
+        printf("  %10.0f%10.0f%10.3f\n", sumreallocs, sumcopies,
+               sumcopies / sumreallocs);
+}
+
+/*
+ * printresident - Print how much of the heap was resident in memory, in
+ *     KB, as sampled while measuring utilization
+ */
+static void printresident(int n, stats_t *stats)
+{
+    int i;
+    bool header = false;
+
+    for (i = 0; i < n; i++)
+    {
+        if (stats[i].valid && stats[i].heap_bytes > 0)
+        {
+            if (!header)
+                printf("\n  %10s%10s%10s  %s\n", "peak heap", "peak RSS",
+                       "end RSS", "trace");
+            header = true;
+            printf("  %10.0f%10.0f%10.0f  %s\n", stats[i].heap_bytes / 1024,
+                   stats[i].rss_peak / 1024, stats[i].rss_end / 1024,
+                   stats[i].filename);
+        }
+    }
+}
+
+/*
+ * printbound - Print the utilization of each trace beside the bound set by
+ *     alignment alone.  Blocks start at aligned addresses, so the heap must
+ *     at some point hold the most live bytes there ever are, each block
+ *     rounded up to a multiple of ALIGNMENT.  Headers and fragmentation
+ *     are not counted, so the bound is loose.
+ */
+static void printbound(int n, stats_t *stats)
+{
+    int i;
+    bool header = false;
+
+    for (i = 0; i < n; i++)
+    {
+        if (stats[i].valid && stats[i].align_bound > 0 &&
+            (stats[i].weight == WALL || stats[i].weight == WUTIL))
+        {
+            if (!header)
+                printf("\n  %8s%8s%10s  %s\n", "util", "bound", "of bound",
+                       "trace");
+            header = true;
+            printf("  %7.1f%%%7.1f%%%9.1f%%  %s\n", stats[i].util * 100.0,
+                   stats[i].align_bound * 100.0,
+                   stats[i].util / stats[i].align_bound * 100.0,
+                   stats[i].filename);
+        }
+    }
+}
+
+/*
+ * printlatency_row - Print the percentiles of one histogram, if not empty
+ */
+static void printlatency_row(const char *op, const char *class,
+                             const hdrhist_t *h)
+{
+    double ns = 1e9 / tsc_rate();
+    if (h->count == 0)
+        return;
+    printf("  %-8s%-7s%10lu%9.0f%9.0f%9.0f%10.0f\n", op, class,
+           (unsigned long)h->count, hdr_percentile(h, 50) * ns,
+           hdr_percentile(h, 99) * ns, hdr_percentile(h, 99.9) * ns,
+           h->max * ns);
+}
+
+/*
+ * printlatency - Print percentiles of the request latencies over all the
+ *     traces, in nanoseconds, for each type of request and size class
+ */
+static void printlatency(void)
+{
+    int type, class;
+    hdrhist_t all;
+
+    printf("\n  %-8s%-7s%10s%9s%9s%9s%10s\n", "latency", "size", "count",
+           "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+    for (type = 0; type <= REALLOC; type++)
+    {
+        hdr_reset(&all);
+        for (class = 0; class < LATENCY_CLASSES; class++)
+        {
+            hdr_add(&all, &latency_hist[type][class]);
+            printlatency_row(latency_op_names[type],
+                             latency_class_names[class],
+                             &latency_hist[type][class]);
+        }
+        printlatency_row(latency_op_names[type], "all", &all);
+    }
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -2014,4 +2725,22 @@ static void usage(char *prog)
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-P <n>     Sparse emulation: <n> bytes per page\n");
+    fprintf(stderr, "\t-M <n>     Sparse emulation: at most <n> pages\n");
+    fprintf(stderr, "\t-Q <f>     Sparse emulation: page table load <f>\n");
+    fprintf(stderr, "\t-H         Use transparent huge pages for the heap\n");
+    fprintf(stderr, "\t-B         Compare throughput with and without "
+                    "huge pages.\n");
+    fprintf(stderr, "\t-j <n>     Check up to <n> traces at once, in "
+                    "separate processes\n");
+    fprintf(stderr, "\t-S         Check for overlapping payloads with the "
+                    "old splay tree\n");
+    fprintf(stderr, "\t-W <file>  Replay the binary trace <file> as it is "
+                    "read\n");
+    fprintf(stderr, "\t-L         Print latency percentiles for each type "
+                    "and size of request\n");
+    fprintf(stderr, "\t-o <file>  Write a CSV time series of heap "
+                    "statistics to <file>\n");
+    fprintf(stderr, "\t-i <n>     Add a row to the time series every <n> "
+                    "ops (default %d)\n", SERIES_INTERVAL);
 }
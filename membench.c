@@ -0,0 +1,148 @@
+/*
+ * membench.c - microbenchmark for the sparse-mode page table in memlib.c
+ *
+ * Replays a few access patterns through mem_read and mem_write on a sparse
+ * heap and reports millions of emulated accesses per second.  The Makefile
+ * links it once against each page table organization (see SPARSE_CHAINED in
+ * config.h), so that "make membench" shows the two side by side.
+ *
+ *   stream   8-byte writes, then reads, over a contiguous region
+ *   random   8-byte reads at random offsets in that region
+ *   scatter  one write and one read in each of many pages spread over a
+ *            very large heap, which exercises the page table itself
+ *   copy     mem_memset and mem_memcpy of large blocks, as done by realloc
+ *            and calloc; counted in 8-byte words
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "fcyc.h"
+#include "memlib.h"
+
+/* Size of the region touched by the stream and random patterns */
+#define STREAM_BYTES (16 * (1 << 20))
+
+/* Number of accesses made by the random pattern */
+#define RANDOM_ACCESSES (1 << 21)
+
+/* Extent of the heap and number of pages touched by the scatter pattern */
+#define SCATTER_HEAP (1UL << 40)
+#define SCATTER_PAGES 40000
+
+typedef struct
+{
+    unsigned char *base;
+    size_t accesses;
+} bench_t;
+
+static bool verbose = false;
+
+/* Keeps the compiler from dropping the reads */
+static volatile uint64_t sink;
+
+/* Small, fast generator, so that it does not dominate the timings */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void bench_stream(void *arg)
+{
+    bench_t *b = (bench_t *)arg;
+    uint64_t sum = 0;
+    size_t i;
+    for (i = 0; i < STREAM_BYTES; i += sizeof(uint64_t))
+        mem_write(b->base + i, i, sizeof(uint64_t));
+    for (i = 0; i < STREAM_BYTES; i += sizeof(uint64_t))
+        sum += mem_read(b->base + i, sizeof(uint64_t));
+    b->accesses = 2 * (STREAM_BYTES / sizeof(uint64_t));
+    sink = sum;
+}
+
+static void bench_random(void *arg)
+{
+    bench_t *b = (bench_t *)arg;
+    uint64_t state = 0x2545F4914F6CDD1DUL;
+    uint64_t sum = 0;
+    size_t i;
+    for (i = 0; i < RANDOM_ACCESSES; i++)
+    {
+        size_t offset = next_random(&state) % (STREAM_BYTES / 8) * 8;
+        sum += mem_read(b->base + offset, sizeof(uint64_t));
+    }
+    b->accesses = RANDOM_ACCESSES;
+    sink = sum;
+}
+
+static void bench_scatter(void *arg)
+{
+    bench_t *b = (bench_t *)arg;
+    uint64_t state = 0x9E3779B97F4A7C15UL;
+    uint64_t sum = 0;
+    size_t i;
+    for (i = 0; i < SCATTER_PAGES; i++)
+    {
+        size_t offset = next_random(&state) % (SCATTER_HEAP / 8) * 8;
+        mem_write(b->base + offset, i, sizeof(uint64_t));
+        sum += mem_read(b->base + offset, sizeof(uint64_t));
+    }
+    b->accesses = 2 * SCATTER_PAGES;
+    sink = sum;
+}
+
+static void bench_copy(void *arg)
+{
+    bench_t *b = (bench_t *)arg;
+    size_t half = STREAM_BYTES / 2;
+    mem_memset(b->base, 0x5A, half);
+    mem_memcpy(b->base + half, b->base, half);
+    b->accesses = 2 * (half / sizeof(uint64_t));
+}
+
+static void run(const char *name, test_funct f, size_t heap_bytes)
+{
+    bench_t b;
+
+    mem_init(true);
+    b.base = mem_sbrk(heap_bytes);
+    if (b.base == (void *)-1)
+    {
+        fprintf(stderr, "membench: mem_sbrk failed\n");
+        exit(1);
+    }
+
+    /* The random pattern only reads, so it needs initialized memory */
+    if (f == bench_random)
+        bench_stream(&b);
+
+    double secs = fsec(f, &b);
+    printf("  %-8s %10.1f Maccesses/s\n", name, b.accesses / secs / 1e6);
+    mem_set_show_stats(verbose);
+    mem_deinit();
+    mem_set_show_stats(false);
+}
+
+int main(int argc, char **argv)
+{
+    /* -v also prints the page and TLB statistics kept by memlib.c */
+    verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+#if SPARSE_CHAINED
+    printf("Chained page table, load %.1f\n", (double)HASH_LOAD);
+#else
+    printf("Open-addressed page table, load %.1f\n", (double)HASH_LOAD);
+#endif
+    run("stream", bench_stream, STREAM_BYTES);
+    run("random", bench_random, STREAM_BYTES);
+    run("scatter", bench_scatter, SCATTER_HEAP);
+    run("copy", bench_copy, STREAM_BYTES);
+    return 0;
+}
@@ -0,0 +1,445 @@
+/*
+ * memlib-sys.c - a version of memlib.c backed by real memory, used to build
+ * mm.c into libmm.so, a shared library that replaces the system malloc.
+ *
+ * The heap is a single range of address space reserved with mmap the first
+ * time mem_init or mem_sbrk is called.  The reservation starts out
+ * inaccessible; mem_sbrk hands it out from the bottom and makes it readable
+ * and writable in SYS_COMMIT_CHUNK steps as the break moves up.  This keeps
+ * the heap contiguous, the way mm.c expects, no matter what else in the
+ * process calls the real sbrk.
+ *
+ * Nothing in here may call malloc or stdio, since those would end up back
+ * in mm.c: failures are reported through errno only.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "memlib.h"
+
+/* private global variables */
+static unsigned char *heap = NULL;    /* Starting address of heap */
+static unsigned char *mem_brk;        /* Current position of break */
+static unsigned char *mem_commit;     /* End of the accessible region */
+static unsigned char *mem_max_addr;   /* Maximum allowable heap address */
+static bool hugepages = false;        /* Use transparent huge pages? */
+
+/* Segments mapped with mem_map, sorted by address */
+typedef struct
+{
+    unsigned char *addr;
+    size_t len;
+} segment_t;
+
+static segment_t segments[MAX_SEGMENTS];
+static size_t num_segments = 0;
+static size_t segment_bytes = 0;      /* Total length of the segments */
+static size_t peak_heapsize = 0;      /* Largest value of mem_heapsize */
+
+/*
+ * update_peak - record a new largest heap size
+ */
+static void update_peak(void)
+{
+    size_t size = mem_heapsize();
+    if (size > peak_heapsize)
+        peak_heapsize = size;
+}
+
+/*
+ * find_segment - return the segment that holds all of [addr, addr + len),
+ *    or NULL
+ */
+static segment_t *find_segment(const void *addr, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)addr;
+    size_t lo = 0, hi = num_segments;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (segments[mid].addr <= p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+    segment_t *seg = &segments[lo - 1];
+    if (p + len > seg->addr + seg->len)
+        return NULL;
+    return seg;
+}
+
+/*
+ * reserve - reserve the address space for the heap, if not done already
+ */
+static bool reserve(void)
+{
+    if (heap != NULL)
+        return true;
+
+    /* With huge pages, reserve one more and trim the ends to alignment */
+    size_t align = hugepages ? HUGE_PAGE_SIZE : 0;
+    unsigned char *addr =
+        mmap(NULL, MAX_SYS_HEAP + align, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+        return false;
+
+    if (hugepages)
+    {
+        unsigned char *start =
+            (unsigned char *)(((uintptr_t)addr + align - 1) & ~(align - 1));
+        if (start > addr)
+            munmap(addr, start - addr);
+        if (addr + align > start)
+            munmap(start + MAX_SYS_HEAP, addr + align - start);
+        madvise(start, MAX_SYS_HEAP, MADV_HUGEPAGE);
+        addr = start;
+    }
+
+    heap = addr;
+    mem_brk = heap;
+    mem_commit = heap;
+    mem_max_addr = heap + MAX_SYS_HEAP;
+    return true;
+}
+
+/*
+ * mem_init - reserve the heap.  There is no sparse mode for a real heap.
+ */
+void mem_init(bool do_sparse)
+{
+    (void)do_sparse;
+    reserve();
+}
+
+/*
+ * mem_deinit - release the heap
+ */
+void mem_deinit(void)
+{
+    while (num_segments > 0)
+        mem_unmap(segments[num_segments - 1].addr);
+    if (heap != NULL)
+        munmap(heap, MAX_SYS_HEAP);
+    heap = NULL;
+}
+
+/*
+ * mem_reset_brk - reset the break to make an empty heap.  The pages stay
+ *    accessible, but their contents are dropped.
+ */
+void mem_reset_brk(void)
+{
+    while (num_segments > 0)
+        mem_unmap(segments[num_segments - 1].addr);
+    peak_heapsize = 0;
+    if (heap == NULL)
+        return;
+    if (mem_commit > heap)
+        madvise(heap, mem_commit - heap, MADV_DONTNEED);
+    mem_brk = heap;
+}
+
+/*
+ * mem_sbrk - extend the heap by incr bytes and return the start address of
+ *    the new area.  The heap cannot be shrunk.
+ */
+void *mem_sbrk(intptr_t incr)
+{
+    if (incr < 0 || !reserve() ||
+        (size_t)incr > (size_t)(mem_max_addr - mem_brk))
+    {
+        errno = ENOMEM;
+        return (void *)-1;
+    }
+
+    unsigned char *old_brk = mem_brk;
+    unsigned char *new_brk = mem_brk + incr;
+    if (new_brk > mem_commit)
+    {
+        size_t length = new_brk - mem_commit;
+        length = (length + SYS_COMMIT_CHUNK - 1) / SYS_COMMIT_CHUNK *
+                 SYS_COMMIT_CHUNK;
+        if (length > (size_t)(mem_max_addr - mem_commit))
+            length = mem_max_addr - mem_commit;
+        if (mprotect(mem_commit, length, PROT_READ | PROT_WRITE) != 0)
+        {
+            errno = ENOMEM;
+            return (void *)-1;
+        }
+        mem_commit += length;
+    }
+
+    mem_brk = new_brk;
+    update_peak();
+    return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo()
+{
+    return (void *)heap;
+}
+
+/*
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi()
+{
+    return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes, segments included
+ */
+size_t mem_heapsize()
+{
+    return (size_t)(mem_brk - heap) + segment_bytes;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size since the last reset
+ */
+size_t mem_peak_heapsize()
+{
+    return peak_heapsize;
+}
+
+/*
+ * mem_map - map a heap segment of at least len bytes
+ */
+void *mem_map(size_t len)
+{
+    size_t psize = (size_t)getpagesize();
+    len = (len + psize - 1) & ~(psize - 1);
+    if (len == 0 || num_segments == MAX_SEGMENTS)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    unsigned char *addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size_t i = num_segments;
+    while (i > 0 && segments[i - 1].addr > addr)
+    {
+        segments[i] = segments[i - 1];
+        i--;
+    }
+    segments[i].addr = addr;
+    segments[i].len = len;
+    num_segments++;
+    segment_bytes += len;
+    update_peak();
+    return addr;
+}
+
+/*
+ * mem_unmap - unmap a segment returned by mem_map
+ */
+bool mem_unmap(void *addr)
+{
+    segment_t *seg = find_segment(addr, 1);
+    if (seg == NULL || seg->addr != addr)
+        return false;
+
+    munmap(seg->addr, seg->len);
+    segment_bytes -= seg->len;
+    num_segments--;
+    memmove(seg, seg + 1, (segments + num_segments - seg) * sizeof(*seg));
+    return true;
+}
+
+/*
+ * mem_is_heap - is [addr, addr + len) in the brk heap or one segment?
+ */
+bool mem_is_heap(const void *addr, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)addr;
+    if (heap != NULL && p >= heap && p + len <= mem_brk)
+        return true;
+    return find_segment(addr, len) != NULL;
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize()
+{
+    return (size_t)getpagesize();
+}
+
+/*
+ * whole_pages - shrink [lo, lo + len) to the system pages it covers
+ *    completely, or the huge pages when the heap uses them.  Return false
+ *    if there are none.
+ */
+static bool whole_pages(void *lo, size_t len, unsigned char **start,
+                        unsigned char **end)
+{
+    uintptr_t psize = (uintptr_t)getpagesize();
+    if (mem_hugepage_size() != 0)
+        psize = mem_hugepage_size(); /* Do not split huge pages */
+    uintptr_t s = ((uintptr_t)lo + psize - 1) & ~(psize - 1);
+    uintptr_t e = ((uintptr_t)lo + len) & ~(psize - 1);
+    if (len == 0 || e <= s)
+        return false;
+    *start = (unsigned char *)s;
+    *end = (unsigned char *)e;
+    return true;
+}
+
+/*
+ * mem_decommit - give the whole pages in [lo, lo + len) back to the
+ *    system.  They stay accessible and read as zero.
+ */
+void mem_decommit(void *lo, size_t len)
+{
+    unsigned char *start, *end;
+    if (whole_pages(lo, len, &start, &end))
+        madvise(start, end - start, MADV_DONTNEED);
+}
+
+/*
+ * mem_recommit - fault the whole pages in [lo, lo + len) back in
+ */
+void mem_recommit(void *lo, size_t len)
+{
+    unsigned char *start, *end;
+    if (!whole_pages(lo, len, &start, &end))
+        return;
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(start, end - start, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    madvise(start, end - start, MADV_WILLNEED);
+}
+
+/*
+ * resident_pages - count the pages of [addr, addr + len) that are resident
+ */
+static size_t resident_pages(unsigned char *addr, size_t len)
+{
+    size_t psize = (size_t)getpagesize();
+    size_t npages = (len + psize - 1) / psize;
+    unsigned char vec[4096];
+    size_t count = 0;
+    size_t i, j;
+    for (i = 0; i < npages; i += sizeof(vec))
+    {
+        size_t n = npages - i;
+        if (n > sizeof(vec))
+            n = sizeof(vec);
+        if (mincore(addr + i * psize, n * psize, vec) != 0)
+            return 0;
+        for (j = 0; j < n; j++)
+            count += vec[j] & 0x1;
+    }
+    return count;
+}
+
+/*
+ * mem_resident_bytes - return the number of heap bytes the system has
+ *    resident
+ */
+size_t mem_resident_bytes()
+{
+    size_t count = 0;
+    size_t i;
+    if (heap != NULL)
+        count = resident_pages(heap, mem_brk - heap);
+    for (i = 0; i < num_segments; i++)
+        count += resident_pages(segments[i].addr, segments[i].len);
+    return count * getpagesize();
+}
+
+/*
+ * The emulation hooks map straight onto memory and libc
+ */
+uint64_t mem_read(const void *addr, size_t len)
+{
+    uint64_t val = 0;
+    memcpy(&val, addr, len);
+    return val;
+}
+
+void mem_write(void *addr, uint64_t val, size_t len)
+{
+    memcpy(addr, &val, len);
+}
+
+void *mem_memcpy(void *dst, const void *src, size_t n)
+{
+    return memcpy(dst, src, n);
+}
+
+void *mem_memset(void *dst, int c, size_t n)
+{
+    return memset(dst, c, n);
+}
+
+int mem_memcmp(const void *s1, const void *s2, size_t n)
+{
+    return memcmp(s1, s2, n);
+}
+
+/*
+ * hprobe - print a region of the heap.  Only meant to be called from a
+ *    debugger, where stdio allocating through mm.c is acceptable.
+ */
+void hprobe(void *ptr, int offset, size_t count)
+{
+    unsigned char *cptr = (unsigned char *)ptr + offset;
+    printf("Bytes %p...%p: 0x", (void *)(cptr + count - 1), (void *)cptr);
+    while (count-- > 0)
+        printf("%.2x", cptr[count]);
+    printf("\n");
+}
+
+void setUBCheck(bool val)
+{
+    (void)val;
+}
+
+void mem_set_show_stats(bool val)
+{
+    (void)val;
+}
+
+/*
+ * mem_set_hugepages - use transparent huge pages for the heap.  Only takes
+ *    effect if called before the heap is first reserved.
+ */
+void mem_set_hugepages(bool val)
+{
+    if (heap == NULL)
+        hugepages = val;
+}
+
+size_t mem_hugepage_size()
+{
+    return hugepages ? HUGE_PAGE_SIZE : 0;
+}
+
+bool mem_config_sparse(size_t page_size, size_t max_pages, double hash_load)
+{
+    (void)page_size;
+    (void)max_pages;
+    (void)hash_load;
+    return true;
+}
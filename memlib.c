@@ -14,6 +14,15 @@
  * map(emulated address / PAGE_SIZE) -> mem_block_t
  * map(mem_block_t, emulated address % PAGE_SIZE) -> byte(s)
  *
+ * The first map is a hash table from page ID to page.  It is open-addressed,
+ *  with a power-of-two number of slots so that the hash needs no division,
+ *  and linear probing.  Pages are never removed individually, so no
+ *  tombstones are needed.  Accesses have a lot of locality, so a small
+ *  direct-mapped software TLB, indexed by the low bits of the page ID, keeps
+ *  the pages found by recent lookups and is checked before the table.  With
+ *  SPARSE_CHAINED set, the table is the original array of chained buckets
+ *  indexed by ID modulo the number of buckets.
+ *
  * This mapping is for a single address; however, accesses can span two blocks
  *  so the mapping sequence checks accounts for size and can perform two
  *  lookups if necessary.
@@ -45,15 +54,38 @@
 #include "config.h"
 #include "memlib.h"
 
-/* Data structure used to implement pages in sparse memory emulation */
+/*
+ * Data structure used to implement pages in sparse memory emulation.  The
+ * page size is chosen at run time, so the header is followed by page_size / 8
+ * bytes of initialization bits and then page_size bytes of page contents.
+ */
 typedef struct MBLK
 {
     size_t id;         /* Page ID.  Counts number of pages from start of heap */
+#if SPARSE_CHAINED
     struct MBLK *next; /* Link for hash table */
-    unsigned char initSet[SPARSE_PAGE_SIZE / 8];
-    unsigned char bytes[SPARSE_PAGE_SIZE]; /* Page contents */
+#endif
+    unsigned char data[]; /* initSet, then bytes (see page_bits/page_bytes) */
 } mem_block_t;
 
+/*
+ * Pages are carved out of chunks obtained from mmap as they are needed.
+ * Chunks are kept, and their pages reused, until mem_deinit.
+ */
+typedef struct PCHUNK
+{
+    struct PCHUNK *next; /* Next chunk in the pool */
+    size_t length;       /* Bytes mapped for this chunk */
+    size_t num_pages;    /* Number of pages in this chunk */
+} pool_chunk_t;
+
+/* A region mapped with mem_map */
+typedef struct
+{
+    unsigned char *addr; /* Start of the segment */
+    size_t len;          /* Length in bytes, a multiple of the page size */
+} segment_t;
+
 /* private global variables */
 static bool sparse = false;         /* Use sparse memory emulation */
 static unsigned char *heap;         /* Starting address of heap */
@@ -65,13 +97,38 @@ static bool show_stats =
     false; /* Should program print allocation information? */
 static bool stats_printed =
     false; /* Has information been printed about allocation */
+static bool hugepages =
+    false; /* Back the dense heap with transparent huge pages? */
+
+/* Segments mapped with mem_map, sorted by address */
+static segment_t segments[MAX_SEGMENTS];
+static size_t num_segments = 0;
+static size_t segment_bytes = 0;    /* Total length of the segments */
+static size_t peak_heapsize = 0;    /* Largest value of mem_heapsize */
+static unsigned char *seg_base;     /* Sparse: start of segment area */
+static unsigned char *seg_brk;      /* Sparse: end of segment area */
+
+/* Sparse memory configuration, see mem_config_sparse */
+static size_t page_size = SPARSE_PAGE_SIZE; /* Bytes per emulated page */
+static size_t page_budget = 0;      /* Maximum pages, 0 for the default */
+static double hash_load = HASH_LOAD; /* Maximum load of page table */
+static unsigned page_shift = 0;     /* log2(page_size) */
+static size_t page_stride = 0;      /* Bytes taken by one mem_block_t */
 
 /* Sparse memory representation */
-static mem_block_t *next_free_page = NULL; /* Next free page */
-static size_t num_pages = 0;               /* Total number of pages */
-static size_t num_free_pages = 0;          /* Number of free pages */
-static mem_block_t **page_table = NULL;    /* Hash table from page ID to page */
-static size_t num_buckets = 0;             /* Number of buckets in page table */
+static size_t num_pages = 0;             /* Maximum number of pages */
+static size_t num_used_pages = 0;        /* Number of pages in use */
+static pool_chunk_t *pool = NULL;        /* Chunks of pages */
+static pool_chunk_t *pool_chunk = NULL;  /* Chunk that pages come from */
+static size_t pool_index = 0;            /* Next unused page in pool_chunk */
+static mem_block_t **page_table = NULL;  /* Hash table from page ID to page */
+static size_t num_buckets = 0;           /* Number of buckets in page table */
+static unsigned bucket_bits = 0;         /* log2(num_buckets) */
+
+/* Software TLB: recently used pages, indexed by page ID mod its size */
+static mem_block_t *tlb[SPARSE_TLB_SIZE];
+static size_t tlb_hits = 0;   /* Lookups satisfied by the TLB */
+static size_t tlb_misses = 0; /* Lookups that went to the page table */
 
 static bool checkUB = true; /* should sparse check for UB */
 
@@ -80,13 +137,67 @@ void setUBCheck(bool val)
     checkUB = val;
 }
 
+void mem_set_show_stats(bool val)
+{
+    show_stats = val;
+}
+
+void mem_set_hugepages(bool val)
+{
+    hugepages = val;
+}
+
+size_t mem_hugepage_size()
+{
+    return hugepages && !sparse ? HUGE_PAGE_SIZE : 0;
+}
+
+bool mem_config_sparse(size_t psize, size_t max_pages, double load)
+{
+    if (psize != 0)
+    {
+        /* A page must hold at least one aligned word of every access */
+        if (psize < 64 || (psize & (psize - 1)) != 0)
+            return false;
+        page_size = psize;
+    }
+    page_budget = max_pages;
+    if (load != 0.0)
+    {
+        /* Open addressing needs some empty slots to end its probes */
+        if (load < 0.0 || (!SPARSE_CHAINED && load >= 1.0))
+            return false;
+        hash_load = load;
+    }
+    return true;
+}
+
 /*
  * Forward declarations
  */
 static size_t page_id(const void *addr);
 static void *page_start(size_t id);
+static unsigned char *page_bits(mem_block_t *block);
+static unsigned char *page_bytes(mem_block_t *block);
+static mem_block_t **new_table(size_t buckets);
+static void grow_table(void);
+static void free_pool(void);
+static mem_block_t *find_page(size_t id);
+static void clear_init_range(mem_block_t *block, size_t offset, size_t len);
+static bool find_init(mem_block_t *block);
 static void *get_mem(const void *addr, size_t, bool);
+static unsigned char *get_mem_range(const void *addr, size_t, bool);
+static bool in_sparse_heap(const void *addr, size_t len);
+static bool outside_sparse_heap(const void *addr, size_t len);
+static size_t page_remaining(const void *addr);
 static void print_stats();
+static void update_peak(void);
+static segment_t *find_segment(const void *addr, size_t len);
+static void unmap_segments(void);
+static void forget_range(unsigned char *start, unsigned char *end);
+static mem_block_t *chunk_page(pool_chunk_t *chunk, size_t i);
+static size_t resident_pages(unsigned char *addr, size_t len);
+static void *map_hugepage_heap(void);
 
 /*
  * mem_init - initialize the memory system model
@@ -96,55 +207,64 @@ void mem_init(bool do_sparse)
     sparse = do_sparse;
     if (sparse)
     {
-        /* Want sparse total allocation to approximately match the dense heap
-         * size */
-        /* Account for both page itself and its amortized contribution to the
-         * page table */
-        double fbytes_per_page =
-            sizeof(mem_block_t) + sizeof(mem_block_t *) / HASH_LOAD;
-        num_pages = (size_t)(MAX_DENSE_HEAP / fbytes_per_page);
-        num_buckets = num_pages / HASH_LOAD;
-        mmap_length = num_buckets * sizeof(mem_block_t *) + // Page table
-                      num_pages * sizeof(mem_block_t) +     // Pages
-                      sizeof(uint64_t);                     // Padding
+        page_shift = 0;
+        while (((size_t)1 << page_shift) < page_size)
+            page_shift++;
+        page_stride = (sizeof(mem_block_t) + page_size / 8 + page_size +
+                       sizeof(uint64_t) - 1) &
+                      ~(sizeof(uint64_t) - 1);
+
+        /* Unless told otherwise, want sparse total allocation to
+         * approximately match the dense heap size.  Account for both page
+         * itself and its amortized contribution to the page table */
+        num_pages = page_budget;
+        if (num_pages == 0)
+        {
+            double fbytes_per_page =
+                page_stride + sizeof(mem_block_t *) / hash_load;
+            num_pages = (size_t)(MAX_DENSE_HEAP / fbytes_per_page);
+        }
+
+        /* Both the page table and the page pool start small and grow */
+        pool = NULL;
+        page_table = new_table(SPARSE_MIN_BUCKETS);
+        heap = SPARSE_HEAP_START;
+        /* The brk heap gets the lower half, segments the upper half */
+        mem_max_addr = heap + MAX_SPARSE_HEAP / 2;
+        seg_base = mem_max_addr;
         setUBCheck(true);
     }
     else
     {
         /* Dense allocation */
-        next_free_page = NULL;
-        num_pages = 0;
-        page_table = NULL;
-        num_buckets = 0;
-        mmap_length = MAX_DENSE_HEAP;
-    }
-
-    int dev_zero = open("/dev/zero", O_RDWR);
-    void *start = sparse ? NULL : TRY_DENSE_HEAP_START;
-    void *addr = mmap(start,                  /* suggested start*/
-                      mmap_length,            /* length */
-                      PROT_READ | PROT_WRITE, /* permissions */
-                      MAP_PRIVATE,            /* private or shared? */
-                      dev_zero,               /* fd */
-                      0);                     /* offset */
-    if (addr == MAP_FAILED)
-    {
-        fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
-        exit(1);
-    }
-    if (sparse)
-    {
-        /* Use initial space for page table */
-        page_table = (mem_block_t **)addr;
-        heap = SPARSE_HEAP_START;
-        mem_max_addr = heap + MAX_SPARSE_HEAP;
-    }
-    else
-    {
+        void *addr;
+        if (hugepages)
+        {
+            addr = map_hugepage_heap();
+        }
+        else
+        {
+            int dev_zero = open("/dev/zero", O_RDWR);
+            addr = mmap(TRY_DENSE_HEAP_START,   /* suggested start*/
+                        mmap_length,            /* length */
+                        PROT_READ | PROT_WRITE, /* permissions */
+                        MAP_PRIVATE,            /* private or shared? */
+                        dev_zero,               /* fd */
+                        0);                     /* offset */
+            close(dev_zero);
+        }
+        if (addr == MAP_FAILED)
+        {
+            fprintf(stderr,
+                    "FAILURE.  mmap couldn't allocate space for heap\n");
+            exit(1);
+        }
         heap = addr;
         mem_max_addr = heap + MAX_DENSE_HEAP;
     }
     stats_printed = false;
+    tlb_hits = 0;
+    tlb_misses = 0;
     mem_brk = heap;
     mem_reset_brk();
 }
@@ -155,11 +275,26 @@ void mem_init(bool do_sparse)
 void mem_deinit(void)
 {
     print_stats();
-    munmap(heap, mmap_length);
-    next_free_page = NULL;
-    num_free_pages = 0;
+    unmap_segments();
+    if (show_stats && sparse && tlb_hits + tlb_misses > 0)
+    {
+        printf("Software TLB: %zu hits, %zu misses (%.2f%% hit rate)\n",
+               tlb_hits, tlb_misses,
+               100.0 * tlb_hits / (tlb_hits + tlb_misses));
+    }
+    if (sparse)
+    {
+        munmap(page_table, num_buckets * sizeof(mem_block_t *));
+        free_pool();
+    }
+    else
+    {
+        munmap(heap, mmap_length);
+    }
+    num_used_pages = 0;
     page_table = NULL;
     num_buckets = 0;
+    memset(tlb, 0, sizeof(tlb));
 }
 
 /*
@@ -168,14 +303,16 @@ void mem_deinit(void)
 void mem_reset_brk()
 {
     print_stats();
+    unmap_segments();
+    peak_heapsize = 0;
     if (sparse)
     {
-        /* Clear page table */
-        size_t ptb = num_buckets * sizeof(mem_block_t *);
-        memset((void *)page_table, 0, ptb);
-        /* First page is just beyond page table */
-        next_free_page = (mem_block_t *)((unsigned char *)page_table + ptb);
-        num_free_pages = num_pages;
+        /* Clear page table, and reuse the pool from its first page */
+        memset((void *)page_table, 0, num_buckets * sizeof(mem_block_t *));
+        num_used_pages = 0;
+        pool_chunk = pool;
+        pool_index = 0;
+        memset(tlb, 0, sizeof(tlb));
     }
     mem_brk = heap;
 }
@@ -218,6 +355,7 @@ void *mem_sbrk(intptr_t incr)
     if (ok)
     {
         mem_brk += incr;
+        update_peak();
         return (void *)old_brk;
     }
     else
@@ -244,11 +382,22 @@ void *mem_heap_hi()
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, counting both the brk
+ *    heap and the segments mapped with mem_map
  */
 size_t mem_heapsize()
 {
-    return (size_t)(mem_brk - heap);
+    return (size_t)(mem_brk - heap) + segment_bytes;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size since the last
+ *    mem_reset_brk.  Unlike the break, segments can be unmapped, so the
+ *    heap can shrink.
+ */
+size_t mem_peak_heapsize()
+{
+    return peak_heapsize;
 }
 
 /*
@@ -259,6 +408,84 @@ size_t mem_pagesize()
     return (size_t)getpagesize();
 }
 
+/*************** Heap segments  *******************/
+
+/*
+ * mem_map - map a new heap segment of at least len bytes, apart from the
+ *    brk heap, and return its address, or NULL if there is no room.  The
+ *    length is rounded up to a multiple of the page size.
+ */
+void *mem_map(size_t len)
+{
+    size_t psize = mem_pagesize();
+    len = (len + psize - 1) & ~(psize - 1);
+    if (len == 0 || num_segments == MAX_SEGMENTS)
+        return NULL;
+
+    unsigned char *addr;
+    if (sparse)
+    {
+        /* Segment addresses are never reused in emulation */
+        if (len > (size_t)(heap + MAX_SPARSE_HEAP - seg_brk))
+            return NULL;
+        addr = seg_brk;
+        seg_brk += len;
+    }
+    else
+    {
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+            return NULL;
+    }
+
+    /* Keep the table sorted by address */
+    size_t i = num_segments;
+    while (i > 0 && segments[i - 1].addr > addr)
+    {
+        segments[i] = segments[i - 1];
+        i--;
+    }
+    segments[i].addr = addr;
+    segments[i].len = len;
+    num_segments++;
+    segment_bytes += len;
+    update_peak();
+    return addr;
+}
+
+/*
+ * mem_unmap - unmap a segment returned by mem_map.  Return false if addr
+ *    is not the start of a segment.
+ */
+bool mem_unmap(void *addr)
+{
+    segment_t *seg = find_segment(addr, 1);
+    if (seg == NULL || seg->addr != addr)
+        return false;
+
+    if (sparse)
+        forget_range(seg->addr, seg->addr + seg->len);
+    else
+        munmap(seg->addr, seg->len);
+    segment_bytes -= seg->len;
+    num_segments--;
+    memmove(seg, seg + 1, (segments + num_segments - seg) * sizeof(*seg));
+    return true;
+}
+
+/*
+ * mem_is_heap - return true if [addr, addr + len) lies within the brk heap
+ *    or within a single segment
+ */
+bool mem_is_heap(const void *addr, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)addr;
+    if (p >= heap && p + len <= mem_brk)
+        return true;
+    return find_segment(addr, len) != NULL;
+}
+
 /*************** Memory emulation  *******************/
 
 __int128 mem_read128(const void *addr)
@@ -279,8 +506,7 @@ void mem_write128(void *addr, __int128 val)
 uint64_t mem_read(const void *addr, size_t len)
 {
     uint64_t rdata;
-    if (sparse && (unsigned char *)addr >= heap &&
-        (unsigned char *)addr + len <= mem_brk)
+    if (in_sparse_heap(addr, len))
     {
         /* Heap read.  Check if it crosses page boundary */
         size_t id = page_id(addr);
@@ -292,7 +518,7 @@ uint64_t mem_read(const void *addr, size_t len)
         {
             void *saddr = page_start(id);
             size_t offset = (unsigned char *)addr - (unsigned char *)saddr;
-            size_t llen = SPARSE_PAGE_SIZE - offset;
+            size_t llen = page_size - offset;
             /* Must zero out upper bytes of data */
             uint64_t mask = ((uint64_t)1 << (8 * llen)) - 1;
             rdata &= mask;
@@ -323,15 +549,14 @@ uint64_t mem_read(const void *addr, size_t len)
 /* Write lower order len bytes of val to address */
 void mem_write(void *addr, uint64_t val, size_t len)
 {
-    if (sparse && (unsigned char *)addr >= heap &&
-        (unsigned char *)addr + len <= mem_brk)
+    if (in_sparse_heap(addr, len))
     {
         /* Heap write.  Check to see if it crosses page boundary */
         size_t id = page_id(addr);
         void *paddr = get_mem(addr, len, true);
         void *saddr = page_start(id);
         size_t offset = (unsigned char *)addr - (unsigned char *)saddr;
-        size_t llen = SPARSE_PAGE_SIZE - offset;
+        size_t llen = page_size - offset;
         if (llen < len)
         {
             /* Two page write */
@@ -366,8 +591,13 @@ void mem_write(void *addr, uint64_t val, size_t len)
     }
 }
 
-/* Emulation of memcpy */
-void *mem_memcpy(void *dst, const void *src, size_t num_bytes)
+/*
+ * Emulation of memcpy, a word at a time.  Used when a range is partly in
+ *  the heap and partly outside of it, which is almost certainly a bug in
+ *  the caller, so that it fails the same way as the equivalent loads and
+ *  stores would.
+ */
+static void *mem_memcpy_words(void *dst, const void *src, size_t num_bytes)
 {
     void *savedst = dst;
     size_t word_size = sizeof(uint64_t);
@@ -387,8 +617,42 @@ void *mem_memcpy(void *dst, const void *src, size_t num_bytes)
     return savedst;
 }
 
-/* Emulation of memset */
-void *mem_memset(void *dst, int c, size_t num_bytes)
+/*
+ * Emulation of memcpy.  Heap ranges are copied in chunks that stay within
+ *  one source and one destination page, so that each page is looked up
+ *  once and its initialization bits are checked and set in bulk.
+ */
+void *mem_memcpy(void *dst, const void *src, size_t num_bytes)
+{
+    bool src_heap = in_sparse_heap(src, num_bytes);
+    bool dst_heap = in_sparse_heap(dst, num_bytes);
+    if ((!src_heap && !outside_sparse_heap(src, num_bytes)) ||
+        (!dst_heap && !outside_sparse_heap(dst, num_bytes)))
+        return mem_memcpy_words(dst, src, num_bytes);
+
+    unsigned char *s = (unsigned char *)src;
+    unsigned char *d = (unsigned char *)dst;
+    while (num_bytes > 0)
+    {
+        size_t len = num_bytes;
+        if (src_heap && page_remaining(s) < len)
+            len = page_remaining(s);
+        if (dst_heap && page_remaining(d) < len)
+            len = page_remaining(d);
+
+        const unsigned char *sp = src_heap ? get_mem_range(s, len, false) : s;
+        unsigned char *dp = dst_heap ? get_mem_range(d, len, true) : d;
+        memmove(dp, sp, len);
+
+        s += len;
+        d += len;
+        num_bytes -= len;
+    }
+    return dst;
+}
+
+/* Emulation of memset, a word at a time.  See mem_memcpy_words */
+static void *mem_memset_words(void *dst, int c, size_t num_bytes)
 {
     void *savedst = dst;
     uint64_t byte = c & 0xFF;
@@ -412,6 +676,175 @@ void *mem_memset(void *dst, int c, size_t num_bytes)
     return savedst;
 }
 
+/* Emulation of memset, a page at a time.  See mem_memcpy */
+void *mem_memset(void *dst, int c, size_t num_bytes)
+{
+    if (!in_sparse_heap(dst, num_bytes))
+    {
+        if (!outside_sparse_heap(dst, num_bytes))
+            return mem_memset_words(dst, c, num_bytes);
+        return memset(dst, c, num_bytes);
+    }
+
+    unsigned char *d = (unsigned char *)dst;
+    while (num_bytes > 0)
+    {
+        size_t len = num_bytes;
+        if (page_remaining(d) < len)
+            len = page_remaining(d);
+        memset(get_mem_range(d, len, true), c, len);
+        d += len;
+        num_bytes -= len;
+    }
+    return dst;
+}
+
+/* Emulation of memcmp, a word at a time.  See mem_memcpy_words */
+static int mem_memcmp_words(const void *s1, const void *s2, size_t num_bytes)
+{
+    const unsigned char *p1 = (const unsigned char *)s1;
+    const unsigned char *p2 = (const unsigned char *)s2;
+    size_t word_size = sizeof(uint64_t);
+    while (num_bytes > 0)
+    {
+        size_t len = num_bytes < word_size ? num_bytes : word_size;
+        uint64_t d1 = mem_read(p1, len);
+        uint64_t d2 = mem_read(p2, len);
+        if (d1 != d2)
+        {
+            /* The lowest differing byte comes first in memory */
+            int shift = __builtin_ctzll(d1 ^ d2) & ~7;
+            return (int)((d1 >> shift) & 0xFF) - (int)((d2 >> shift) & 0xFF);
+        }
+        p1 += len;
+        p2 += len;
+        num_bytes -= len;
+    }
+    return 0;
+}
+
+/* Emulation of memcmp, a page at a time.  See mem_memcpy */
+int mem_memcmp(const void *s1, const void *s2, size_t num_bytes)
+{
+    bool heap1 = in_sparse_heap(s1, num_bytes);
+    bool heap2 = in_sparse_heap(s2, num_bytes);
+    if ((!heap1 && !outside_sparse_heap(s1, num_bytes)) ||
+        (!heap2 && !outside_sparse_heap(s2, num_bytes)))
+        return mem_memcmp_words(s1, s2, num_bytes);
+
+    const unsigned char *p1 = (const unsigned char *)s1;
+    const unsigned char *p2 = (const unsigned char *)s2;
+    while (num_bytes > 0)
+    {
+        size_t len = num_bytes;
+        if (heap1 && page_remaining(p1) < len)
+            len = page_remaining(p1);
+        if (heap2 && page_remaining(p2) < len)
+            len = page_remaining(p2);
+
+        int diff = memcmp(heap1 ? get_mem_range(p1, len, false) : p1,
+                          heap2 ? get_mem_range(p2, len, false) : p2, len);
+        if (diff != 0)
+            return diff;
+
+        p1 += len;
+        p2 += len;
+        num_bytes -= len;
+    }
+    return 0;
+}
+
+/*************** Decommitting heap memory  *******************/
+
+/*
+ * Shrink [lo, lo + len) to the system pages it covers completely, or the
+ * huge pages when the heap uses them.  Return false if there are none.
+ */
+static bool whole_pages(void *lo, size_t len, unsigned char **start,
+                        unsigned char **end)
+{
+    uintptr_t psize = (uintptr_t)getpagesize();
+    if (mem_hugepage_size() != 0)
+        psize = mem_hugepage_size(); /* Do not split huge pages */
+    uintptr_t s = ((uintptr_t)lo + psize - 1) & ~(psize - 1);
+    uintptr_t e = ((uintptr_t)lo + len) & ~(psize - 1);
+    if (len == 0 || e <= s)
+        return false;
+    *start = (unsigned char *)s;
+    *end = (unsigned char *)e;
+    return true;
+}
+
+/*
+ * mem_decommit - give the whole pages in [lo, lo + len) back to the system.
+ *    Their contents are lost: afterward they read as zero in dense mode,
+ *    and count as uninitialized in sparse mode.
+ */
+void mem_decommit(void *lo, size_t len)
+{
+    unsigned char *start, *end;
+    if (!whole_pages(lo, len, &start, &end))
+        return;
+    if (!sparse)
+    {
+        madvise(start, end - start, MADV_DONTNEED);
+        return;
+    }
+
+    forget_range(start, end);
+}
+
+/*
+ * mem_recommit - get the whole pages in [lo, lo + len) ready for use again
+ *    after mem_decommit.  They read as zero.
+ */
+void mem_recommit(void *lo, size_t len)
+{
+    unsigned char *start, *end;
+    if (!whole_pages(lo, len, &start, &end))
+        return;
+    if (sparse)
+    {
+        mem_memset(start, 0, end - start);
+        return;
+    }
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(start, end - start, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    madvise(start, end - start, MADV_WILLNEED);
+}
+
+/*
+ * mem_resident_bytes - return the number of heap bytes backed by memory.
+ *    In dense mode, these are the pages the system has resident; in sparse
+ *    mode, the emulated pages that hold any initialized bytes.
+ */
+size_t mem_resident_bytes()
+{
+    size_t count = 0;
+    size_t i;
+    if (sparse)
+    {
+        pool_chunk_t *chunk;
+        size_t left = num_used_pages;
+        for (chunk = pool; chunk != NULL && left > 0; chunk = chunk->next)
+        {
+            for (i = 0; i < chunk->num_pages && left > 0; i++, left--)
+            {
+                if (find_init(chunk_page(chunk, i)))
+                    count++;
+            }
+        }
+        return count * page_size;
+    }
+
+    count = resident_pages(heap, mem_brk - heap);
+    for (i = 0; i < num_segments; i++)
+        count += resident_pages(segments[i].addr, segments[i].len);
+    return count * getpagesize();
+}
+
 /* Function to aid in viewing contents of heap */
 void hprobe(void *ptr, int offset, size_t count)
 {
@@ -443,6 +876,68 @@ void hprobe(void *ptr, int offset, size_t count)
 
 /*************** Private Functions *******************/
 
+/* Record a new largest heap size */
+static void update_peak(void)
+{
+    size_t size = mem_heapsize();
+    if (size > peak_heapsize)
+        peak_heapsize = size;
+}
+
+/* Find the segment that holds all of [addr, addr + len), or NULL */
+static segment_t *find_segment(const void *addr, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)addr;
+    size_t lo = 0, hi = num_segments;
+
+    /* Find the last segment that starts at or below addr */
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (segments[mid].addr <= p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+    segment_t *seg = &segments[lo - 1];
+    if (p + len > seg->addr + seg->len)
+        return NULL;
+    return seg;
+}
+
+/* Unmap every segment */
+static void unmap_segments(void)
+{
+    while (num_segments > 0)
+        mem_unmap(segments[num_segments - 1].addr);
+    seg_brk = seg_base;
+}
+
+/*
+ * Map the dense heap on a huge page boundary and ask for transparent huge
+ * pages.  Map one huge page too many, then trim the ends to alignment.
+ */
+static void *map_hugepage_heap(void)
+{
+    size_t align = HUGE_PAGE_SIZE;
+    unsigned char *addr =
+        mmap(TRY_DENSE_HEAP_START, mmap_length + align,
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return MAP_FAILED;
+
+    unsigned char *start =
+        (unsigned char *)(((uintptr_t)addr + align - 1) & ~(align - 1));
+    if (start > addr)
+        munmap(addr, start - addr);
+    if (addr + align > start)
+        munmap(start + mmap_length, addr + align - start);
+    madvise(start, mmap_length, MADV_HUGEPAGE);
+    return start;
+}
+
 static void print_stats()
 {
     size_t vbytes = mem_heapsize();
@@ -450,8 +945,8 @@ static void print_stats()
         return;
     if (sparse)
     {
-        size_t ppages = num_pages - num_free_pages;
-        size_t pbytes = ppages * SPARSE_PAGE_SIZE;
+        size_t ppages = num_used_pages;
+        size_t pbytes = ppages * page_size;
         printf("Allocated %zu/%zu pages (%zu bytes) to cover %zu heap bytes "
                "(%.4f%% density).  Max address = %p\n",
                ppages, num_pages, pbytes, vbytes, 100.0 * pbytes / vbytes,
@@ -469,48 +964,246 @@ static void print_stats()
 static size_t page_id(const void *addr)
 {
     size_t offset = (unsigned char *)addr - (unsigned char *)SPARSE_HEAP_START;
-    return offset / SPARSE_PAGE_SIZE;
+    return offset >> page_shift;
 }
 
 /* Given a page ID, compute its starting address */
 static void *page_start(size_t id)
 {
-    size_t offset = id * SPARSE_PAGE_SIZE;
+    size_t offset = id << page_shift;
     return (void *)((unsigned char *)SPARSE_HEAP_START + offset);
 }
 
-/* Get memory to store value.  Allocate page if necessary */
-static void *get_mem(const void *addr, size_t size, bool isWrite)
+/* The initialization bits of a page */
+static unsigned char *page_bits(mem_block_t *block)
 {
-    size_t id = page_id(addr);
-    size_t b = id % num_buckets; // A very simple hash function
-    unsigned int i;
+    return block->data;
+}
+
+/* The contents of a page */
+static unsigned char *page_bytes(mem_block_t *block)
+{
+    return block->data + page_size / 8;
+}
+
+/* Map memory for the sparse emulation itself */
+static void *map_sparse(size_t length)
+{
+    void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        fprintf(stderr, "FAILURE.  Ran out of memory for emulation "
+                        "(mmap failed)\n");
+        exit(1);
+    }
+    return addr;
+}
+
+/* Allocate an empty page table with the given number of buckets */
+static mem_block_t **new_table(size_t buckets)
+{
+    num_buckets = buckets;
+    bucket_bits = 0;
+    while (((size_t)1 << bucket_bits) < buckets)
+        bucket_bits++;
+    return (mem_block_t **)map_sparse(buckets * sizeof(mem_block_t *));
+}
+
+/* Release all chunks of the page pool */
+static void free_pool(void)
+{
+    while (pool != NULL)
+    {
+        pool_chunk_t *next = pool->next;
+        munmap(pool, pool->length);
+        pool = next;
+    }
+    pool_chunk = NULL;
+    pool_index = 0;
+}
+
+/* Take a fresh page from the pool for page ID id */
+static mem_block_t *new_page(size_t id)
+{
+    if (num_used_pages == num_pages)
+    {
+        /*
+         * This will often fail due to student code that either accesses
+         *  too many memory locations, such as checking every byte in a
+         *  block.  Or more commonly due to poor utilization, such as
+         *  leaking or not finding the huge allocations.
+         */
+        fprintf(stderr, "FAILURE.  Ran out of memory for emulation "
+                        "(all %zu pages in use, see mdriver -M)\n",
+                num_pages);
+        exit(1);
+    }
+
+    /* Move on to the next chunk, mapping a new one at the end of the pool */
+    size_t header = (sizeof(pool_chunk_t) + 15) & ~(size_t)15;
+    if (pool_chunk == NULL || pool_index == pool_chunk->num_pages)
+    {
+        pool_chunk_t *next = pool_chunk ? pool_chunk->next : pool;
+        if (next == NULL)
+        {
+            size_t length = SPARSE_POOL_CHUNK;
+            if (length < header + page_stride)
+                length = header + page_stride;
+            next = (pool_chunk_t *)map_sparse(length);
+            next->next = NULL;
+            next->length = length;
+            next->num_pages = (length - header) / page_stride;
+            if (pool_chunk)
+                pool_chunk->next = next;
+            else
+                pool = next;
+        }
+        pool_chunk = next;
+        pool_index = 0;
+    }
+
+    mem_block_t *block = chunk_page(pool_chunk, pool_index);
+    pool_index++;
+    num_used_pages++;
+    block->id = id;
+    memset(page_bits(block), 0, page_size / 8);
+    return block;
+}
+
+/* The i-th page of a chunk of the pool */
+static mem_block_t *chunk_page(pool_chunk_t *chunk, size_t i)
+{
+    size_t header = (sizeof(pool_chunk_t) + 15) & ~(size_t)15;
+    return (mem_block_t *)((unsigned char *)chunk + header + i * page_stride);
+}
+
+/* Double the size of the page table, once it is loaded beyond hash_load */
+static void grow_table(void)
+{
+    mem_block_t **old_table = page_table;
+    size_t old_buckets = num_buckets;
+    size_t b, i;
+
+    page_table = new_table(2 * old_buckets);
+    size_t mask = num_buckets - 1;
+    for (i = 0; i < old_buckets; i++)
+    {
+#if SPARSE_CHAINED
+        mem_block_t *block = old_table[i];
+        while (block != NULL)
+        {
+            mem_block_t *next = block->next;
+            b = block->id & mask;
+            block->next = page_table[b];
+            page_table[b] = block;
+            block = next;
+        }
+#else
+        mem_block_t *block = old_table[i];
+        if (block == NULL)
+            continue;
+        b = (block->id ^ (block->id >> bucket_bits)) & mask;
+        while (page_table[b] != NULL)
+            b = (b + 1) & mask;
+        page_table[b] = block;
+#endif
+    }
+    munmap(old_table, old_buckets * sizeof(mem_block_t *));
+}
+
+/* Find the page for page ID id in the page table, or NULL if it has none */
+static mem_block_t *find_page(size_t id)
+{
+    size_t mask = num_buckets - 1;
+#if SPARSE_CHAINED
+    mem_block_t *block = page_table[id & mask];
+    while (block && block->id != id)
+        block = block->next;
+    return block;
+#else
+    size_t b = (id ^ (id >> bucket_bits)) & mask;
+    mem_block_t *block;
+    while ((block = page_table[b]) != NULL && block->id != id)
+        b = (b + 1) & mask;
+    return block;
+#endif
+}
+
+/* Find the page for page ID id in the page table, adding it if necessary */
+static mem_block_t *lookup_page(size_t id)
+{
+    size_t mask = num_buckets - 1;
+#if SPARSE_CHAINED
+    size_t b = id & mask; // A very simple hash function
 
     mem_block_t *block = page_table[b];
     while (block && block->id != id)
         block = block->next;
     if (!block)
     {
-        /* Need to allocate a new block */
-        if (num_free_pages == 0)
+        block = new_page(id);
+        if (num_used_pages > hash_load * num_buckets)
         {
-            /*
-             * This will often fail due to student code that either accesses
-             *  too many memory locations, such as checking every byte in a
-             *  block.  Or more commonly due to poor utilization, such as
-             *  leaking or not finding the huge allocations.
-             */
-            fprintf(stderr, "FAILURE.  Ran out of memory for emulation\n");
-            exit(1);
+            grow_table();
+            b = id & (num_buckets - 1);
         }
-        block = next_free_page++;
-        num_free_pages--;
-        block->id = id;
         block->next = page_table[b];
-        for (i = 0; i < (SPARSE_PAGE_SIZE / 8); i++)
-            block->initSet[i] = 0;
         page_table[b] = block;
     }
+    return block;
+#else
+    /* Pages of a heap are mostly contiguous, so the low bits of the ID map
+     * them to distinct, neighbouring slots.  Folding in the high bits
+     * spreads out IDs that differ only above the table size. */
+    size_t b = (id ^ (id >> bucket_bits)) & mask;
+
+    mem_block_t *block;
+    while ((block = page_table[b]) != NULL && block->id != id)
+        b = (b + 1) & mask;
+    if (!block)
+    {
+        block = new_page(id);
+        if (num_used_pages > hash_load * num_buckets)
+        {
+            /* Find a new slot in the larger table */
+            grow_table();
+            mask = num_buckets - 1;
+            b = (id ^ (id >> bucket_bits)) & mask;
+            while (page_table[b] != NULL)
+                b = (b + 1) & mask;
+        }
+        page_table[b] = block;
+    }
+    return block;
+#endif
+}
+
+/* Find the page for page ID id, through the TLB */
+static mem_block_t *get_page(size_t id)
+{
+    mem_block_t **entry = &tlb[id & (SPARSE_TLB_SIZE - 1)];
+    mem_block_t *block = *entry;
+    if (block && block->id == id)
+    {
+        tlb_hits++;
+    }
+    else
+    {
+        tlb_misses++;
+        block = lookup_page(id);
+        *entry = block;
+    }
+    return block;
+}
+
+/* Get memory to store value.  Allocate page if necessary */
+static void *get_mem(const void *addr, size_t size, bool isWrite)
+{
+    size_t id = page_id(addr);
+    unsigned int i;
+
+    mem_block_t *block = get_page(id);
 
     // Convert an emulated address into an offset
     void *saddr = page_start(id);
@@ -520,36 +1213,261 @@ static void *get_mem(const void *addr, size_t size, bool isWrite)
     size_t offsetIdx = offset / 8;
     size_t offsetBit = offset & 0x7;
 
-    // For each byte in this access, update the bitvector that tracks
-    //  the use / initialization of emulated bytes.
-    for (i = 0; i < size; i++)
+    // Update or check the bits that track the use / initialization of the
+    //  emulated bytes.  An access of up to 8 bytes covers at most two bytes
+    //  of the bit vector, so the whole access is handled with one mask.  The
+    //  part of an access that spills into the next page is left to the
+    //  caller's second lookup.
+    assert(size <= sizeof(uint64_t));
+    size_t len = size;
+    if (len > page_size - offset)
+        len = page_size - offset;
+    unsigned int mask = ((1u << len) - 1) << offsetBit;
+    unsigned char *bits = &page_bits(block)[offsetIdx];
+
+    if (isWrite)
     {
-        if (isWrite)
-        {
-            block->initSet[offsetIdx] |= (0x1 << offsetBit);
-        }
-        else if (checkUB &&
-                 (block->initSet[offsetIdx] & (0x1 << offsetBit)) == 0)
+        bits[0] |= (unsigned char)mask;
+        if (mask > 0xFF)
+            bits[1] |= (unsigned char)(mask >> 8);
+    }
+    else if (checkUB)
+    {
+        unsigned int set = bits[0];
+        if (mask > 0xFF)
+            set |= (unsigned int)bits[1] << 8;
+        unsigned int missing = mask & ~set;
+        if (missing != 0)
         {
             // The student code has attempted to read an address that was
             //  never written to.  Students should set a breakpoint on this
             //  line / check and then backtrace to where their code has
             //  made the memory access.
+            i = __builtin_ctz(missing) - offsetBit;
             fprintf(stderr,
                     "Attempt to read uninitialized address %p, see %s:%d for "
                     "details\n",
                     (addr + i), __FILE__, __LINE__);
             exit(1);
         }
-        offsetBit++;
-        if (offsetBit == 8)
+    }
+
+    return (void *)&page_bytes(block)[offset];
+}
+
+/* Mark bytes [offset, offset + len) of a page as uninitialized */
+static void clear_init_range(mem_block_t *block, size_t offset, size_t len)
+{
+    size_t end = offset + len;
+    while (offset < end && (offset & 0x7) != 0)
+    {
+        page_bits(block)[offset / 8] &= ~(0x1 << (offset & 0x7));
+        offset++;
+    }
+    size_t full = (end - offset) / 8;
+    memset(&page_bits(block)[offset / 8], 0, full);
+    offset += 8 * full;
+    while (offset < end)
+    {
+        page_bits(block)[offset / 8] &= ~(0x1 << (offset & 0x7));
+        offset++;
+    }
+}
+
+/*
+ * Mark [start, end) as uninitialized.  Only emulated pages that exist can
+ * have initialized bytes, so for a large range scan the pool instead
+ */
+static void forget_range(unsigned char *start, unsigned char *end)
+{
+    if ((size_t)(end - start) / page_size > num_used_pages)
+    {
+        size_t first = page_id(start);
+        size_t last = page_id(end - 1);
+        size_t left = num_used_pages;
+        pool_chunk_t *chunk;
+        size_t i;
+        for (chunk = pool; chunk != NULL && left > 0; chunk = chunk->next)
         {
-            offsetBit = 0;
-            offsetIdx++;
+            for (i = 0; i < chunk->num_pages && left > 0; i++, left--)
+            {
+                mem_block_t *block = chunk_page(chunk, i);
+                if (block->id < first || block->id > last)
+                    continue;
+                unsigned char *lo = page_start(block->id);
+                unsigned char *hi = lo + page_size;
+                if (lo < start)
+                    lo = start;
+                if (hi > end)
+                    hi = end;
+                clear_init_range(block, lo - (unsigned char *)page_start(
+                                                  block->id),
+                                 hi - lo);
+            }
         }
-        if (offsetIdx == (SPARSE_PAGE_SIZE / 8))
-            break;
+        return;
+    }
+
+    while (start < end)
+    {
+        size_t plen = end - start;
+        if (page_remaining(start) < plen)
+            plen = page_remaining(start);
+        size_t id = page_id(start);
+        mem_block_t *block = find_page(id);
+        if (block != NULL)
+        {
+            size_t offset = start - (unsigned char *)page_start(id);
+            clear_init_range(block, offset, plen);
+        }
+        start += plen;
+    }
+}
+
+/* Count the system pages of [addr, addr + len) that are resident */
+static size_t resident_pages(unsigned char *addr, size_t len)
+{
+    size_t psize = (size_t)getpagesize();
+    size_t npages = (len + psize - 1) / psize;
+    unsigned char vec[4096];
+    size_t count = 0;
+    size_t i, j;
+    for (i = 0; i < npages; i += sizeof(vec))
+    {
+        size_t n = npages - i;
+        if (n > sizeof(vec))
+            n = sizeof(vec);
+        if (mincore(addr + i * psize, n * psize, vec) != 0)
+            return 0;
+        for (j = 0; j < n; j++)
+            count += vec[j] & 0x1;
     }
+    return count;
+}
 
-    return (void *)&block->bytes[offset];
+/* Does a page have any initialized bytes? */
+static bool find_init(mem_block_t *block)
+{
+    const unsigned char *bits = page_bits(block);
+    size_t i;
+    for (i = 0; i < page_size / 8; i++)
+        if (bits[i] != 0)
+            return true;
+    return false;
+}
+
+/* Mark bytes [offset, offset + len) of a page as initialized */
+static void set_init_range(mem_block_t *block, size_t offset, size_t len)
+{
+    size_t end = offset + len;
+    while (offset < end && (offset & 0x7) != 0)
+    {
+        page_bits(block)[offset / 8] |= (0x1 << (offset & 0x7));
+        offset++;
+    }
+    size_t full = (end - offset) / 8;
+    memset(&page_bits(block)[offset / 8], 0xFF, full);
+    offset += 8 * full;
+    while (offset < end)
+    {
+        page_bits(block)[offset / 8] |= (0x1 << (offset & 0x7));
+        offset++;
+    }
+}
+
+/*
+ * Return the offset of the first byte in [offset, offset + len) of a page
+ * that has not been initialized, or offset + len if there is none
+ */
+static size_t find_uninit(mem_block_t *block, size_t offset, size_t len)
+{
+    size_t end = offset + len;
+    while (offset < end)
+    {
+        unsigned char bits = page_bits(block)[offset / 8];
+        if ((offset & 0x7) == 0 && end - offset >= 8)
+        {
+            /* Whole bit vector byte at a time */
+            if (bits != 0xFF)
+                return offset + __builtin_ctz(~bits & 0xFF);
+            offset += 8;
+        }
+        else
+        {
+            if ((bits & (0x1 << (offset & 0x7))) == 0)
+                return offset;
+            offset++;
+        }
+    }
+    return end;
+}
+
+/*
+ * Get len bytes of memory at addr, which must not cross a page, and set or
+ * check their initialization bits all at once.  Allocate page if necessary
+ */
+static unsigned char *get_mem_range(const void *addr, size_t len,
+                                    bool isWrite)
+{
+    size_t id = page_id(addr);
+    mem_block_t *block = get_page(id);
+    size_t offset = (unsigned char *)addr - (unsigned char *)page_start(id);
+    assert(offset + len <= page_size);
+
+    if (isWrite)
+    {
+        set_init_range(block, offset, len);
+    }
+    else if (checkUB)
+    {
+        size_t bad = find_uninit(block, offset, len);
+        if (bad < offset + len)
+        {
+            // See get_mem
+            fprintf(stderr,
+                    "Attempt to read uninitialized address %p, see %s:%d for "
+                    "details\n",
+                    (void *)((unsigned char *)addr + (bad - offset)),
+                    __FILE__, __LINE__);
+            exit(1);
+        }
+    }
+    return &page_bytes(block)[offset];
+}
+
+/* Is all of [addr, addr + len) part of the emulated heap? */
+static bool in_sparse_heap(const void *addr, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)addr;
+    if (!sparse)
+        return false;
+    if (p >= heap && p + len <= mem_brk)
+        return true;
+    return p >= seg_base && p < seg_brk && find_segment(addr, len) != NULL;
+}
+
+/* Does [addr, addr + len) stay clear of the emulated heap? */
+static bool outside_sparse_heap(const void *addr, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)addr;
+    if (!sparse)
+        return true;
+    if (p + len > heap && p < mem_brk)
+        return false;
+    size_t i;
+    for (i = 0; i < num_segments; i++)
+    {
+        if (p + len > segments[i].addr &&
+            p < segments[i].addr + segments[i].len)
+            return false;
+    }
+    return true;
+}
+
+/* Bytes from addr to the end of its page */
+static size_t page_remaining(const void *addr)
+{
+    size_t id = page_id(addr);
+    return page_size -
+           ((unsigned char *)addr - (unsigned char *)page_start(id));
 }
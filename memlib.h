@@ -10,6 +10,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * @brief
  * @param[in] sparse
@@ -56,10 +60,46 @@ void *mem_heap_hi(void);
 
 /**
  * @brief Returns the number of bytes being used by the heap.
+ *
+ * This counts the brk heap, from mem_heap_lo to mem_heap_hi, as well as
+ * every segment mapped with mem_map.
+ *
  * @return The size of the heap, in bytes
  */
 size_t mem_heapsize(void);
 
+/**
+ * @brief Returns the largest heap size since the heap was last reset.
+ * @return The peak of mem_heapsize(), in bytes
+ */
+size_t mem_peak_heapsize(void);
+
+/**
+ * @brief Maps a heap segment apart from the brk heap.
+ *
+ * Segments are independent of each other and of the break, so they can
+ * hold large objects or separate arenas, and can be released with
+ * mem_unmap.  mem_reset_brk unmaps all of them.
+ *
+ * @param[in] len The length of the segment, rounded up to the page size
+ * @return The start of the segment, or NULL if there is no room
+ */
+void *mem_map(size_t len);
+
+/**
+ * @brief Unmaps a segment returned by mem_map.
+ * @param[in] addr The start of the segment
+ * @return false if addr is not the start of a segment
+ */
+bool mem_unmap(void *addr);
+
+/**
+ * @brief Checks whether a range lies in the brk heap or in one segment.
+ * @param[in] addr The start of the range
+ * @param[in] len  The length of the range, in bytes
+ */
+bool mem_is_heap(const void *addr, size_t len);
+
 /**
  * @brief Returns the system page size.
  * @return The page size of the system, in bytes
@@ -105,6 +145,15 @@ void *mem_memcpy(void *dst, const void *src, size_t n);
  */
 void *mem_memset(void *dst, int c, size_t n);
 
+/**
+ * @brief Emulation of memcmp
+ * @param[in] s1
+ * @param[in] s2
+ * @param[in] n
+ * @return
+ */
+int mem_memcmp(const void *s1, const void *s2, size_t n);
+
 /**
  * @brief Debugging function to view region of heap
  * @param[in] ptr
@@ -117,3 +166,60 @@ void hprobe(void *ptr, int offset, size_t count);
  * @brief Set whether the driver should check for UB
  */
 void setUBCheck(bool);
+
+/**
+ * @brief Set whether to print heap and emulation statistics, such as the
+ *        number of sparse pages and the software TLB hit rate
+ */
+void mem_set_show_stats(bool);
+
+/**
+ * @brief Return the whole pages in [lo, lo + len) to the system
+ *
+ * The contents of those pages are lost.  In the regular driver they read
+ * as zero afterward; in mdriver-emulate they count as uninitialized.
+ */
+void mem_decommit(void *lo, size_t len);
+
+/**
+ * @brief Make the whole pages in [lo, lo + len) ready for use after
+ *        mem_decommit.  They read as zero.
+ */
+void mem_recommit(void *lo, size_t len);
+
+/**
+ * @brief Returns the number of heap bytes actually held in memory
+ */
+size_t mem_resident_bytes(void);
+
+/**
+ * @brief Set whether the next mem_init backs the heap with transparent
+ *        huge pages.  This has no effect on sparse emulation.
+ */
+void mem_set_hugepages(bool);
+
+/**
+ * @brief Returns the huge page size when the heap uses transparent huge
+ *        pages, and 0 otherwise
+ *
+ * An allocator can grow the heap in multiples of this size, so that the
+ * end of the heap never splits a huge page.
+ */
+size_t mem_hugepage_size(void);
+
+/**
+ * @brief Configure sparse emulation for the next call to mem_init
+ *
+ * @param[in] page_size Bytes per page, a power of two of at least 64
+ * @param[in] max_pages Maximum number of pages the emulation may allocate
+ * @param[in] hash_load Maximum load of the page table before it grows
+ * @return false if a parameter is out of range
+ *
+ * Passing 0 for a parameter selects its default from config.h.  By
+ * default, the emulation uses about as much memory as the dense heap.
+ */
+bool mem_config_sparse(size_t page_size, size_t max_pages, double hash_load);
+
+#ifdef __cplusplus
+}
+#endif
@@ -32,6 +32,8 @@
 #define calloc mm_calloc
 #define memset mem_memset
 #define memcpy mem_memcpy
+#define memalign mm_memalign
+#define malloc_usable_size mm_usable_size
 #endif /* def DRIVER */
 
 /* You can change anything from here onward */
@@ -104,6 +106,9 @@ bool mm_init(void)
  */
 void *malloc(size_t size)
 {
+    if (size > SIZE_MAX - HEADER_SIZE - ALIGNMENT)
+        return NULL;
+
     size_t newsize = roundup(size + HEADER_SIZE, ALIGNMENT);
     block_t *block = (block_t *)mem_sbrk(newsize);
 
@@ -182,6 +187,35 @@ void *calloc(size_t nmemb, size_t size)
     return newptr;
 }
 
+/*
+ * memalign - Pad the heap so that the next payload lands on a multiple
+ *      of alignment, then allocate there.
+ */
+void *memalign(size_t alignment, size_t size)
+{
+    if ((alignment & (alignment - 1)) != 0)
+        return NULL;
+    if (alignment <= ALIGNMENT)
+        return malloc(size);
+
+    char *payload = (char *)mem_heap_hi() + 1 + HEADER_SIZE;
+    size_t pad = (alignment - ((uintptr_t)payload & (alignment - 1))) &
+                 (alignment - 1);
+    if (pad > 0 && mem_sbrk(pad) == (void *)-1)
+        return NULL;
+    return malloc(size);
+}
+
+/*
+ * malloc_usable_size - Everything in the block after the header.
+ */
+size_t malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    return payload_to_header(ptr)->size - HEADER_SIZE;
+}
+
 /*
  * mm_checkheap - There are no bugs in my code, so I don't need to
  *      check, so nah! (But if I did, I could call this function using
@@ -193,6 +227,18 @@ bool mm_checkheap(int lineno)
     return true;
 }
 
+/*
+ * mm_heapstats - Nothing is ever freed for reuse, so there are no free
+ *      blocks to report.
+ */
+bool mm_heapstats(mm_heapstats_t *stats)
+{
+    stats->free_blocks = 0;
+    stats->free_bytes = 0;
+    stats->largest_free = 0;
+    return false;
+}
+
 /***********************************************************************
  * Support functions
  ***********************************************************************/
@@ -0,0 +1,70 @@
+/**
+ * @file mm-policy.cc
+ * @brief Exports one specialization of mm-policy.hpp through mm.h
+ *
+ * Compile with exactly one MM_VARIANT_<name> macro defined to select the
+ * variant; the Makefile does this for every name in POLICY_VARIANTS and
+ * links each object into its own mdriver-policy-<name>.
+ */
+
+#include "mm-policy.hpp"
+
+using namespace mm_policy;
+
+#if defined(MM_VARIANT_first)
+/* The same choices mm.c makes, apart from mini blocks */
+typedef Allocator<FirstFit, TraceClasses, uint64_t, ImmediateCoalesce>
+    variant_t;
+#elif defined(MM_VARIANT_best)
+typedef Allocator<BestFit, TraceClasses, uint64_t, ImmediateCoalesce>
+    variant_t;
+#elif defined(MM_VARIANT_pow2)
+typedef Allocator<FirstFit, PowerOfTwoClasses<14>, uint64_t,
+                  ImmediateCoalesce>
+    variant_t;
+#elif defined(MM_VARIANT_narrow)
+/* 4-byte headers and footers; blocks are limited to 4 GB */
+typedef Allocator<FirstFit, TraceClasses, uint32_t, ImmediateCoalesce>
+    variant_t;
+#elif defined(MM_VARIANT_deferred)
+typedef Allocator<FirstFit, TraceClasses, uint64_t, DeferredCoalesce>
+    variant_t;
+#else
+#error "Define one of the MM_VARIANT_* macros to pick an allocator variant"
+#endif
+
+bool mm_init(void) {
+    return variant_t::init();
+}
+
+void *mm_malloc(size_t size) {
+    return variant_t::malloc(size);
+}
+
+void mm_free(void *ptr) {
+    variant_t::free(ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size) {
+    return variant_t::realloc(ptr, size);
+}
+
+void *mm_calloc(size_t nmemb, size_t size) {
+    return variant_t::calloc(nmemb, size);
+}
+
+void *mm_memalign(size_t alignment, size_t size) {
+    return variant_t::memalign(alignment, size);
+}
+
+size_t mm_usable_size(void *ptr) {
+    return variant_t::usable_size(ptr);
+}
+
+bool mm_checkheap(int line) {
+    return variant_t::checkheap(line);
+}
+
+bool mm_heapstats(mm_heapstats_t *stats) {
+    return variant_t::heapstats(stats);
+}
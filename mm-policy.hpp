@@ -0,0 +1,742 @@
+/**
+ * @file mm-policy.hpp
+ * @brief Policy-based segregated free list allocator
+ *
+ * This header builds specialized versions of the segregated free list
+ * allocator in mm.c from a single source. The knobs that are hard-coded
+ * constants in mm.c are template parameters here:
+ *
+ * - Fit: how a block is picked from a size class (FirstFit, BestFit)
+ * - Classes: the size class table (TraceClasses, PowerOfTwoClasses<N>)
+ * - Word: the width of headers and footers (uint64_t, uint32_t)
+ * - Coalesce: when adjacent free blocks are merged (ImmediateCoalesce,
+ *   DeferredCoalesce)
+ *
+ * Every policy is resolved at compile time, so a variant carries no
+ * branches for the configurations it does not use. mm-policy.cc
+ * instantiates one variant per object file and exports it through the
+ * driver interface in mm.h; the Makefile links one mdriver-policy-<name>
+ * per variant.
+ *
+ * Block layout: a header word holding the block size, the allocation bit
+ * and the allocation bit of the previous block. Free blocks also hold next
+ * and previous free list pointers at the start of the payload, and a copy
+ * of the header as a footer in their last word. Allocated blocks have no
+ * footer. Payloads are 16-byte aligned, so with a narrow header each block
+ * starts 4 bytes before an alignment boundary.
+ */
+#ifndef MM_POLICY_HPP
+#define MM_POLICY_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+namespace mm_policy {
+
+/*
+ * ---------------------------------------------------------------------------
+ *                              CLASS TABLES
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * The class boundaries generated by size-classes.pl for mm.c, which
+ * rewrites the lines between the markers together with mm.c's table.
+ * mm.c reserves its first class for 16-byte mini blocks, which this
+ * allocator does not have, so that class is left out here.
+ */
+/* BEGIN SEG CLASS TABLE */
+static const size_t trace_class_limit[] = {
+    32, 48, 64, 112, 176, 256, 512, 1024, 2048, 4096, 8192, 16384};
+/* END SEG CLASS TABLE */
+
+/**
+ * @brief The class boundaries in trace_class_limit, with one more class
+ *        for everything larger.
+ */
+struct TraceClasses {
+    static const int count =
+        sizeof(trace_class_limit) / sizeof(trace_class_limit[0]) + 1;
+
+    /** @brief Returns the class for blocks of `size` bytes */
+    static int index(size_t size) {
+        int c;
+        for (c = 0; c < count - 1; c++) {
+            if (size <= trace_class_limit[c]) {
+                return c;
+            }
+        }
+        return count - 1;
+    }
+
+    /** @brief Returns true if a block of `size` bytes may sit in class `c` */
+    static bool holds(int c, size_t size) {
+        return index(size) == c;
+    }
+};
+
+/**
+ * @brief Power-of-two classes: class c holds blocks of at most 32 << c bytes,
+ *        and the last of the N classes takes everything larger.
+ */
+template <int N> struct PowerOfTwoClasses {
+    static const int count = N;
+
+    /** @brief Returns the class for blocks of `size` bytes */
+    static int index(size_t size) {
+        if (size <= 32) {
+            return 0;
+        }
+        // Position of the highest bit of (size - 1), relative to 32
+        int c = (int)(8 * sizeof(unsigned long)) -
+                __builtin_clzl((unsigned long)(size - 1)) - 5;
+        return c < N ? c : N - 1;
+    }
+
+    /** @brief Returns true if a block of `size` bytes may sit in class `c` */
+    static bool holds(int c, size_t size) {
+        return index(size) == c;
+    }
+};
+
+/*
+ * ---------------------------------------------------------------------------
+ *                              BLOCK LAYOUT
+ * ---------------------------------------------------------------------------
+ */
+
+/** @brief A heap block whose header and footer are `Word` wide */
+template <typename Word> struct Block {
+    /** @brief Header contains size + allocation flags */
+    Word header;
+
+    static const size_t wsize = sizeof(Word);
+    static const Word alloc_mask = 0x1;
+    static const Word prev_alloc_mask = 0x2;
+    static const Word size_mask = ~(Word)0xF;
+
+    static Word pack(size_t size, bool prev_alloc, bool alloc) {
+        Word word = (Word)size;
+        if (alloc) {
+            word |= alloc_mask;
+        }
+        if (prev_alloc) {
+            word |= prev_alloc_mask;
+        }
+        return word;
+    }
+
+    static Block *from_payload(void *bp) {
+        return (Block *)((char *)bp - wsize);
+    }
+
+    size_t size() const {
+        return (size_t)(header & size_mask);
+    }
+
+    bool alloc() const {
+        return (header & alloc_mask) != 0;
+    }
+
+    bool prev_alloc() const {
+        return (header & prev_alloc_mask) != 0;
+    }
+
+    char *payload() {
+        return (char *)this + wsize;
+    }
+
+    Word *footer() {
+        return (Word *)((char *)this + size() - wsize);
+    }
+
+    Block *next() {
+        return (Block *)((char *)this + size());
+    }
+
+    /** @brief Only valid when the previous block is free */
+    Block *prev() {
+        Word footer = *(Word *)((char *)this - wsize);
+        return (Block *)((char *)this - (size_t)(footer & size_mask));
+    }
+
+    Block *&next_free() {
+        return *(Block **)payload();
+    }
+
+    Block *&prev_free() {
+        return *(Block **)(payload() + sizeof(Block *));
+    }
+
+    void write(size_t size, bool prev_alloc, bool alloc) {
+        header = pack(size, prev_alloc, alloc);
+    }
+
+    void write_footer() {
+        *footer() = header;
+    }
+
+    /** @brief Updates the previous block's bit, keeping a footer in sync */
+    void set_prev_alloc(bool prev_alloc) {
+        header = pack(size(), prev_alloc, alloc());
+        if (!alloc()) {
+            write_footer();
+        }
+    }
+};
+
+/*
+ * ---------------------------------------------------------------------------
+ *                              FIT POLICIES
+ * ---------------------------------------------------------------------------
+ */
+
+/** @brief Takes the first block in the class that is large enough */
+struct FirstFit {
+    template <typename B> static B *choose(B *head, size_t asize) {
+        for (B *block = head; block != NULL; block = block->next_free()) {
+            if (block->size() >= asize) {
+                return block;
+            }
+        }
+        return NULL;
+    }
+};
+
+/** @brief Takes the smallest block in the class that is large enough */
+struct BestFit {
+    template <typename B> static B *choose(B *head, size_t asize) {
+        B *best = NULL;
+        for (B *block = head; block != NULL; block = block->next_free()) {
+            size_t size = block->size();
+            if (size == asize) {
+                return block;
+            }
+            if (size > asize && (best == NULL || size < best->size())) {
+                best = block;
+            }
+        }
+        return best;
+    }
+};
+
+/*
+ * ---------------------------------------------------------------------------
+ *                           COALESCING POLICIES
+ * ---------------------------------------------------------------------------
+ */
+
+/** @brief Merge a block with its free neighbors as soon as it is freed */
+struct ImmediateCoalesce {
+    static const bool deferred = false;
+};
+
+/**
+ * @brief Leave freed blocks unmerged, and sweep the whole heap for runs of
+ *        free blocks only when no block in the free lists fits a request.
+ *
+ * A sweep walks every block, so it is skipped until enough bytes have been
+ * freed since the last one (a sixteenth of the heap) to pay for it.
+ */
+struct DeferredCoalesce {
+    static const bool deferred = true;
+};
+
+/*
+ * ---------------------------------------------------------------------------
+ *                                ALLOCATOR
+ * ---------------------------------------------------------------------------
+ */
+
+template <class Fit, class Classes, typename Word, class Coalesce>
+class Allocator {
+  public:
+    typedef Block<Word> block_t;
+
+    static bool init();
+    static void *malloc(size_t size);
+    static void free(void *bp);
+    static void *realloc(void *ptr, size_t size);
+    static void *calloc(size_t elements, size_t size);
+    static void *memalign(size_t alignment, size_t size);
+    static size_t usable_size(void *bp);
+    static bool checkheap(int line);
+    static bool heapstats(mm_heapstats_t *stats);
+
+  private:
+    static const size_t wsize = sizeof(Word);
+    static const size_t dsize = 16;
+    static const size_t chunksize = (1 << 12);
+    /** @brief Header, two free list pointers and footer, rounded up */
+    static const size_t min_block_size =
+        (2 * sizeof(Word) + 2 * sizeof(void *) + dsize - 1) / dsize * dsize;
+    /** @brief Largest block size the header can represent */
+    static const size_t max_block_size = (size_t)Block<Word>::size_mask;
+
+    static block_t *heap_start;
+    static block_t *seg_list[Classes::count];
+    /** @brief Bytes freed without coalescing since the last sweep */
+    static size_t deferred_bytes;
+
+    static size_t max(size_t x, size_t y) {
+        return (x > y) ? x : y;
+    }
+
+    static size_t round_up(size_t size, size_t n) {
+        return n * ((size + (n - 1)) / n);
+    }
+
+    static size_t adjust(size_t size) {
+        return max(round_up(size + wsize, dsize), min_block_size);
+    }
+
+    static void insert_free(block_t *block);
+    static void remove_free(block_t *block);
+    static block_t *coalesce(block_t *block);
+    static void coalesce_all();
+    static void release(block_t *block);
+    static block_t *extend_heap(size_t size);
+    static block_t *find_fit(size_t asize);
+    static void place(block_t *block, size_t asize);
+    static void shrink(block_t *block, size_t asize);
+};
+
+template <class F, class C, typename W, class D>
+typename Allocator<F, C, W, D>::block_t *Allocator<F, C, W, D>::heap_start =
+    NULL;
+
+template <class F, class C, typename W, class D>
+typename Allocator<F, C, W, D>::block_t
+    *Allocator<F, C, W, D>::seg_list[C::count];
+
+template <class F, class C, typename W, class D>
+size_t Allocator<F, C, W, D>::deferred_bytes = 0;
+
+/** @brief Pushes a free block on the front of its class list */
+template <class F, class C, typename W, class D>
+void Allocator<F, C, W, D>::insert_free(block_t *block) {
+    int c = C::index(block->size());
+    block->next_free() = seg_list[c];
+    block->prev_free() = NULL;
+    if (seg_list[c] != NULL) {
+        seg_list[c]->prev_free() = block;
+    }
+    seg_list[c] = block;
+}
+
+/** @brief Unlinks a free block from its class list */
+template <class F, class C, typename W, class D>
+void Allocator<F, C, W, D>::remove_free(block_t *block) {
+    block_t *prev = block->prev_free();
+    block_t *next = block->next_free();
+    if (prev == NULL) {
+        seg_list[C::index(block->size())] = next;
+    } else {
+        prev->next_free() = next;
+    }
+    if (next != NULL) {
+        next->prev_free() = prev;
+    }
+}
+
+/**
+ * @brief Merges a free block that is in no list with its free neighbors,
+ *        and inserts the result into its class list.
+ */
+template <class F, class C, typename W, class D>
+typename Allocator<F, C, W, D>::block_t *
+Allocator<F, C, W, D>::coalesce(block_t *block) {
+    size_t size = block->size();
+    block_t *next = block->next();
+
+    if (!next->alloc()) {
+        remove_free(next);
+        size += next->size();
+    }
+    if (!block->prev_alloc()) {
+        block_t *prev = block->prev();
+        remove_free(prev);
+        size += prev->size();
+        block = prev;
+    }
+
+    block->write(size, block->prev_alloc(), false);
+    block->write_footer();
+    block->next()->set_prev_alloc(false);
+    insert_free(block);
+    return block;
+}
+
+/** @brief Merges every run of adjacent free blocks in the heap */
+template <class F, class C, typename W, class D>
+void Allocator<F, C, W, D>::coalesce_all() {
+    block_t *block = heap_start;
+    deferred_bytes = 0;
+    while (block->size() > 0) {
+        block_t *next = block->next();
+        if (block->alloc() || next->alloc()) {
+            block = next;
+            continue;
+        }
+
+        remove_free(block);
+        size_t size = block->size();
+        while (!next->alloc()) {
+            remove_free(next);
+            size += next->size();
+            next = next->next();
+        }
+        block->write(size, block->prev_alloc(), false);
+        block->write_footer();
+        insert_free(block);
+        block = next;
+    }
+}
+
+/**
+ * @brief Hands a block whose header and footer already mark it free back to
+ *        the free lists, following the coalescing policy.
+ */
+template <class F, class C, typename W, class D>
+void Allocator<F, C, W, D>::release(block_t *block) {
+    if (D::deferred) {
+        block->next()->set_prev_alloc(false);
+        insert_free(block);
+        deferred_bytes += block->size();
+    } else {
+        coalesce(block);
+    }
+}
+
+/** @brief Grows the heap by a free block of at least `size` bytes */
+template <class F, class C, typename W, class D>
+typename Allocator<F, C, W, D>::block_t *
+Allocator<F, C, W, D>::extend_heap(size_t size) {
+    size = round_up(size, dsize);
+    void *bp = mem_sbrk((intptr_t)size);
+    if (bp == (void *)-1) {
+        return NULL;
+    }
+
+    // The new block starts at the old epilogue header
+    block_t *block = block_t::from_payload(bp);
+    block->write(size, block->prev_alloc(), false);
+    block->write_footer();
+    block->next()->write(0, false, true);
+
+    // Merge with a free last block even when coalescing is deferred, so
+    // that repeated extensions do not fragment the end of the heap
+    return coalesce(block);
+}
+
+template <class F, class C, typename W, class D>
+typename Allocator<F, C, W, D>::block_t *
+Allocator<F, C, W, D>::find_fit(size_t asize) {
+    for (int c = C::index(asize); c < C::count; c++) {
+        block_t *block = F::choose(seg_list[c], asize);
+        if (block != NULL) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+/** @brief Allocates `asize` bytes of a free block, splitting off the rest */
+template <class F, class C, typename W, class D>
+void Allocator<F, C, W, D>::place(block_t *block, size_t asize) {
+    size_t block_size = block->size();
+    bool prev_alloc = block->prev_alloc();
+
+    remove_free(block);
+    if (block_size - asize >= min_block_size) {
+        block->write(asize, prev_alloc, true);
+        block_t *rest = block->next();
+        rest->write(block_size - asize, true, false);
+        rest->write_footer();
+        insert_free(rest);
+    } else {
+        block->write(block_size, prev_alloc, true);
+        block->next()->set_prev_alloc(true);
+    }
+}
+
+/** @brief Trims an allocated block down to `asize` bytes */
+template <class F, class C, typename W, class D>
+void Allocator<F, C, W, D>::shrink(block_t *block, size_t asize) {
+    size_t block_size = block->size();
+    if (block_size - asize < min_block_size) {
+        return;
+    }
+    block->write(asize, block->prev_alloc(), true);
+    block_t *rest = block->next();
+    rest->write(block_size - asize, true, false);
+    rest->write_footer();
+    release(rest);
+}
+
+template <class F, class C, typename W, class D>
+bool Allocator<F, C, W, D>::init() {
+    char *start = (char *)mem_sbrk(dsize);
+    if (start == (void *)-1) {
+        return false;
+    }
+
+    // The first header sits one word before an alignment boundary, right
+    // after the prologue footer
+    W *prologue = (W *)(start + dsize - 2 * wsize);
+    W *epilogue = (W *)(start + dsize - wsize);
+    *prologue = block_t::pack(0, true, true);
+    *epilogue = block_t::pack(0, true, true);
+    heap_start = (block_t *)epilogue;
+
+    for (int c = 0; c < C::count; c++) {
+        seg_list[c] = NULL;
+    }
+    deferred_bytes = 0;
+
+    return extend_heap(chunksize) != NULL;
+}
+
+template <class F, class C, typename W, class D>
+void *Allocator<F, C, W, D>::malloc(size_t size) {
+    if (heap_start == NULL && !init()) {
+        return NULL;
+    }
+    if (size == 0 || size > max_block_size - dsize) {
+        return NULL;
+    }
+
+    size_t asize = adjust(size);
+    block_t *block = find_fit(asize);
+    if (block == NULL && D::deferred &&
+        deferred_bytes >= max(asize, mem_heapsize() / 16)) {
+        coalesce_all();
+        block = find_fit(asize);
+    }
+    if (block == NULL) {
+        block = extend_heap(max(asize, chunksize));
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    place(block, asize);
+    return block->payload();
+}
+
+template <class F, class C, typename W, class D>
+void Allocator<F, C, W, D>::free(void *bp) {
+    if (bp == NULL) {
+        return;
+    }
+    block_t *block = block_t::from_payload(bp);
+    block->write(block->size(), block->prev_alloc(), false);
+    block->write_footer();
+    release(block);
+}
+
+template <class F, class C, typename W, class D>
+void *Allocator<F, C, W, D>::realloc(void *ptr, size_t size) {
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (size > max_block_size - dsize) {
+        return NULL;
+    }
+
+    // Shrinking, or growing within the slack of the block, stays in place
+    block_t *block = block_t::from_payload(ptr);
+    size_t asize = adjust(size);
+    if (asize <= block->size()) {
+        shrink(block, asize);
+        return ptr;
+    }
+
+    void *newptr = malloc(size);
+    if (newptr == NULL) {
+        return NULL;
+    }
+    mem_memcpy(newptr, ptr, block->size() - wsize);
+    free(ptr);
+    return newptr;
+}
+
+template <class F, class C, typename W, class D>
+void *Allocator<F, C, W, D>::calloc(size_t elements, size_t size) {
+    if (elements == 0) {
+        return NULL;
+    }
+    size_t asize = elements * size;
+    if (asize / elements != size) {
+        // Multiplication overflowed
+        return NULL;
+    }
+
+    void *bp = malloc(asize);
+    if (bp != NULL) {
+        mem_memset(bp, 0, asize);
+    }
+    return bp;
+}
+
+/** @brief Carves an aligned block out of a larger one, freeing the rest */
+template <class F, class C, typename W, class D>
+void *Allocator<F, C, W, D>::memalign(size_t alignment, size_t size) {
+    if (alignment <= dsize) {
+        return malloc(size);
+    }
+    if (size == 0 || (alignment & (alignment - 1)) != 0 ||
+        alignment > max_block_size / 4 ||
+        size > max_block_size - dsize - 2 * alignment) {
+        return NULL;
+    }
+
+    // Leave room to skip a gap too small to be a free block of its own
+    size_t asize = adjust(size);
+    char *bp = (char *)malloc(asize + alignment + min_block_size - wsize);
+    if (bp == NULL) {
+        return NULL;
+    }
+
+    block_t *block = block_t::from_payload(bp);
+    size_t gap = (alignment - ((uintptr_t)bp & (alignment - 1))) &
+                 (alignment - 1);
+    if (gap > 0 && gap < min_block_size) {
+        gap += alignment;
+    }
+    if (gap > 0) {
+        size_t block_size = block->size();
+        block->write(gap, block->prev_alloc(), false);
+        block->write_footer();
+        block_t *aligned = block->next();
+        aligned->write(block_size - gap, false, true);
+        release(block);
+        block = aligned;
+    }
+
+    shrink(block, asize);
+    return block->payload();
+}
+
+template <class F, class C, typename W, class D>
+size_t Allocator<F, C, W, D>::usable_size(void *bp) {
+    if (bp == NULL) {
+        return 0;
+    }
+    return block_t::from_payload(bp)->size() - wsize;
+}
+
+template <class F, class C, typename W, class D>
+bool Allocator<F, C, W, D>::checkheap(int line) {
+    char *lo = (char *)mem_heap_lo();
+    char *hi = (char *)mem_heap_hi();
+
+    W prologue = *((W *)heap_start - 1);
+    if ((prologue & block_t::size_mask) != 0 ||
+        !(prologue & block_t::alloc_mask)) {
+        printf("line %d: bad prologue footer\n", line);
+        return false;
+    }
+
+    size_t free_blocks = 0;
+    bool prev_alloc = true;
+    block_t *block;
+    for (block = heap_start; block->size() > 0; block = block->next()) {
+        size_t size = block->size();
+        if ((uintptr_t)block->payload() % dsize != 0 || size % dsize != 0 ||
+            size < min_block_size) {
+            printf("line %d: block %p is misaligned or has bad size %zu\n",
+                   line, (void *)block, size);
+            return false;
+        }
+        if ((char *)block + size > hi + 1) {
+            printf("line %d: block %p runs past the heap\n", line,
+                   (void *)block);
+            return false;
+        }
+        if (block->prev_alloc() != prev_alloc) {
+            printf("line %d: block %p has a stale prev_alloc bit\n", line,
+                   (void *)block);
+            return false;
+        }
+        if (!block->alloc()) {
+            if (*block->footer() != block->header) {
+                printf("line %d: header of %p does not match footer\n", line,
+                       (void *)block);
+                return false;
+            }
+            if (!D::deferred && !prev_alloc) {
+                printf("line %d: free blocks are consecutive at %p\n", line,
+                       (void *)block);
+                return false;
+            }
+            free_blocks++;
+        }
+        prev_alloc = block->alloc();
+    }
+    if (!block->alloc() || block->prev_alloc() != prev_alloc ||
+        (char *)block + wsize != hi + 1) {
+        printf("line %d: bad epilogue header\n", line);
+        return false;
+    }
+
+    size_t list_blocks = 0;
+    for (int c = 0; c < C::count; c++) {
+        block_t *prev = NULL;
+        for (block = seg_list[c]; block != NULL; block = block->next_free()) {
+            if ((char *)block < lo || (char *)block > hi) {
+                printf("line %d: free list %d points outside the heap\n",
+                       line, c);
+                return false;
+            }
+            if (block->alloc() || !C::holds(c, block->size())) {
+                printf("line %d: block %p does not belong in free list %d\n",
+                       line, (void *)block, c);
+                return false;
+            }
+            if (block->prev_free() != prev) {
+                printf("line %d: next/previous pointers are not consistent\n",
+                       line);
+                return false;
+            }
+            prev = block;
+            list_blocks++;
+        }
+    }
+    if (list_blocks != free_blocks) {
+        printf("line %d: %zu free blocks but %zu in free lists\n", line,
+               free_blocks, list_blocks);
+        return false;
+    }
+    return true;
+}
+
+template <class F, class C, typename W, class D>
+bool Allocator<F, C, W, D>::heapstats(mm_heapstats_t *stats) {
+    stats->free_blocks = 0;
+    stats->free_bytes = 0;
+    stats->largest_free = 0;
+    for (int c = 0; c < C::count; c++) {
+        for (block_t *block = seg_list[c]; block != NULL;
+             block = block->next_free()) {
+            stats->free_blocks++;
+            stats->free_bytes += block->size();
+            if (block->size() > stats->largest_free) {
+                stats->largest_free = block->size();
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace mm_policy
+
+#endif /* MM_POLICY_HPP */
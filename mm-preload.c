@@ -0,0 +1,172 @@
+/*
+ * mm-preload.c - exports mm.c under the standard libc allocation names, so
+ * that libmm.so can replace the system malloc in unmodified programs:
+ *
+ *     unix> LD_PRELOAD=./libmm.so ls -l
+ *
+ * mm.c is compiled with -DDRIVER as for mdriver, so its entry points are
+ * the mm_* names from mm.h; memlib-sys.c supplies the heap.  mm.c is not
+ * thread-safe, so every call is serialized on a single lock, and the heap
+ * is initialized by whichever call comes first.
+ *
+ * mm.c returns NULL for zero-byte requests, but many programs treat that as
+ * running out of memory, so those are rounded up to one byte here.
+ *
+ * Setting MM_HUGEPAGES in the environment backs the heap with transparent
+ * huge pages, which mm.c then grows a whole huge page at a time.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool mm_ready = false;
+
+/*
+ * lock - enter the allocator, initializing the heap on first use
+ */
+static bool lock(void)
+{
+    pthread_mutex_lock(&mm_lock);
+    if (!mm_ready)
+        mm_ready = mm_init();
+    return mm_ready;
+}
+
+static void unlock(void)
+{
+    pthread_mutex_unlock(&mm_lock);
+}
+
+/*
+ * A child only inherits the thread that called fork, so the lock must not
+ * be held by any other thread at that moment
+ */
+static void atfork_prepare(void)
+{
+    pthread_mutex_lock(&mm_lock);
+}
+
+static void atfork_release(void)
+{
+    pthread_mutex_unlock(&mm_lock);
+}
+
+__attribute__((constructor)) static void preload_init(void)
+{
+    pthread_atfork(atfork_prepare, atfork_release, atfork_release);
+    if (getenv("MM_HUGEPAGES") != NULL)
+        mem_set_hugepages(true);
+}
+
+void *malloc(size_t size)
+{
+    void *p = NULL;
+    if (lock())
+        p = mm_malloc(size == 0 ? 1 : size);
+    unlock();
+    if (p == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    lock();
+    mm_free(ptr);
+    unlock();
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return malloc(size);
+
+    void *p = NULL;
+    if (lock())
+        p = mm_realloc(ptr, size);
+    unlock();
+    if (p == NULL && size != 0)
+        errno = ENOMEM;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (nmemb == 0 || size == 0)
+        nmemb = size = 1;
+
+    void *p = NULL;
+    if (lock())
+        p = mm_calloc(nmemb, size);
+    unlock();
+    if (p == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if ((alignment & (alignment - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void *p = NULL;
+    if (lock())
+        p = mm_memalign(alignment, size == 0 ? 1 : size);
+    unlock();
+    if (p == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+
+    int saved_errno = errno;
+    void *p = memalign(alignment, size);
+    if (p == NULL)
+        return ENOMEM;
+    errno = saved_errno;
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(getpagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t pagesize = getpagesize();
+    return memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+
+    lock();
+    size_t size = mm_usable_size(ptr);
+    unlock();
+    return size;
+}
@@ -0,0 +1,396 @@
+/*
+ * mm-record.c - records the allocation requests of an unmodified program
+ * as a trace that mdriver can replay:
+ *
+ *     unix> MM_RECORD=ls.rep LD_PRELOAD=./librecord.so ls -l
+ *     unix> ./mdriver -f ls.rep
+ *
+ * malloc, calloc, realloc, free and the aligned allocation calls are
+ * passed on to the C library, and each one is noted as an event with a
+ * sequence number taken from a single atomic counter.  Events go into a
+ * buffer private to the calling thread, so recording takes no lock; a full
+ * buffer is appended to a raw event file with a single write, which the
+ * kernel keeps whole however many threads do the same.  A thread that
+ * exits hands its buffer on to the next one to start, so a program that
+ * keeps starting threads needs no more buffers than it ever has threads
+ * at once.  When the program exits, the events are sorted back into
+ * sequence order and turned into a .rep file, with a trace id for each
+ * block in place of its address.
+ *
+ * Blocks allocated before the recorder starts, and their frees, are left
+ * out, as is anything done by a child after fork.  Aligned allocations
+ * are recorded as plain mallocs of the same size.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bintrace.h"
+#include "idmap.h"
+
+/* The allocator underneath, from glibc */
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+/* Number of events in a thread's buffer */
+#define RECORD_EVENTS 8192
+
+typedef struct
+{
+    uint64_t seq;
+    uint64_t type; /* ALLOC, FREE or REALLOC */
+    uint64_t ptr;  /* Block returned, or freed */
+    uint64_t old;  /* Block passed to realloc */
+    uint64_t size;
+} event_t;
+
+typedef struct buffer
+{
+    struct buffer *next; /* All buffers, for flushing at exit */
+    atomic_bool in_use;  /* Owned by a live thread */
+    size_t count;
+    event_t events[RECORD_EVENTS];
+} buffer_t;
+
+static char out_path[4096];
+static char raw_path[4096 + 8];
+static int raw_fd = -1;
+static pid_t record_pid;
+static pthread_key_t buffer_key;
+static atomic_bool recording = false;
+static atomic_uint_fast64_t next_seq = 0;
+static _Atomic(buffer_t *) all_buffers = NULL;
+
+static __thread buffer_t *my_buffer __attribute__((tls_model("initial-exec")));
+
+/*
+ * flush - append the events of a buffer to the raw event file
+ */
+static void flush(buffer_t *buf)
+{
+    size_t len = buf->count * sizeof(event_t);
+    if (len > 0 && write(raw_fd, buf->events, len) != (ssize_t)len)
+        atomic_store(&recording, false);
+    buf->count = 0;
+}
+
+/*
+ * claim_buffer - take over a buffer left by a thread that has exited.
+ *     Buffers never leave the list, so it can be walked without a lock.
+ */
+static buffer_t *claim_buffer(void)
+{
+    buffer_t *buf;
+    for (buf = atomic_load(&all_buffers); buf != NULL; buf = buf->next)
+    {
+        bool idle = false;
+        if (!atomic_load_explicit(&buf->in_use, memory_order_relaxed) &&
+            atomic_compare_exchange_strong(&buf->in_use, &idle, true))
+            return buf;
+    }
+    return NULL;
+}
+
+/*
+ * thread_buffer - the calling thread's buffer, found on its first event
+ */
+static buffer_t *thread_buffer(void)
+{
+    if (my_buffer != NULL)
+        return my_buffer;
+
+    buffer_t *buf = claim_buffer();
+    if (buf == NULL)
+    {
+        buf = mmap(NULL, sizeof(buffer_t), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED)
+            return NULL;
+        buf->count = 0;
+        atomic_init(&buf->in_use, true);
+        buf->next = atomic_load(&all_buffers);
+        while (!atomic_compare_exchange_weak(&all_buffers, &buf->next, buf))
+            ;
+    }
+    my_buffer = buf;
+    pthread_setspecific(buffer_key, buf);
+    return buf;
+}
+
+/*
+ * record - note one event.  The sequence number must be taken before a
+ *     block is freed and after one is allocated, so that a block handed
+ *     out again by another thread sorts after the free that released it.
+ */
+static void record(uint64_t seq, int type, void *ptr, void *old, size_t size)
+{
+    buffer_t *buf = thread_buffer();
+    if (buf == NULL)
+        return;
+    event_t *e = &buf->events[buf->count++];
+    e->seq = seq;
+    e->type = type;
+    e->ptr = (uintptr_t)ptr;
+    e->old = (uintptr_t)old;
+    e->size = size;
+    if (buf->count == RECORD_EVENTS)
+        flush(buf);
+}
+
+#define ACTIVE() atomic_load_explicit(&recording, memory_order_relaxed)
+
+static uint64_t take_seq(void)
+{
+    return atomic_fetch_add_explicit(&next_seq, 1, memory_order_relaxed);
+}
+
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+    if (p != NULL && ACTIVE())
+        record(take_seq(), ALLOC, p, NULL, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+    if (p != NULL && ACTIVE())
+        record(take_seq(), ALLOC, p, NULL, nmemb * size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL && ACTIVE())
+        record(take_seq(), FREE, ptr, NULL, 0);
+    __libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    /* The old block may be reused as soon as it is released */
+    uint64_t seq = ACTIVE() ? take_seq() : 0;
+    void *p = __libc_realloc(ptr, size);
+    if (ACTIVE() && (p != NULL || size == 0))
+        record(seq, REALLOC, p, ptr, size);
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p = __libc_memalign(alignment, size);
+    if (p != NULL && ACTIVE())
+        record(take_seq(), ALLOC, p, NULL, size);
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    void *p = memalign(alignment, size);
+    if (p == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(getpagesize(), size);
+}
+
+/*
+ * A thread that exits leaves its events in the file, and its buffer on
+ * the list, empty, for the next thread to claim.  Any event the thread
+ * records after this takes a buffer again.
+ */
+static void thread_exit(void *arg)
+{
+    buffer_t *buf = arg;
+    my_buffer = NULL;
+    flush(buf);
+    atomic_store(&buf->in_use, false);
+}
+
+static void stop_in_child(void)
+{
+    atomic_store(&recording, false);
+}
+
+/* What convert found, for the header of the trace */
+typedef struct
+{
+    long num_ids;
+    long num_ops;
+    size_t peak_bytes;
+} summary_t;
+
+/*
+ * release - end the life of a live block, writing a free for it
+ */
+static void release(idmap_t *map, identry_t *entry, FILE *fp, summary_t *sum,
+                    size_t *live)
+{
+    if (fp != NULL)
+        fprintf(fp, "f %ld\n", entry->index);
+    sum->num_ops++;
+    *live -= entry->size;
+    idmap_remove(map, entry->id);
+}
+
+/*
+ * convert - turn the sorted events into trace requests, written to fp
+ *     unless it is NULL.  The live blocks are kept in an idmap_t keyed by
+ *     address.  Events that refer to blocks the recorder never saw
+ *     allocated are dropped, and a block that turns up again without
+ *     having been freed is taken to have been freed just before.
+ */
+static bool convert(const event_t *events, size_t n, FILE *fp, summary_t *sum)
+{
+    idmap_t *map = idmap_new();
+    size_t i, live = 0;
+    identry_t *entry;
+
+    memset(sum, 0, sizeof(*sum));
+    for (i = 0; i < n; i++)
+    {
+        const event_t *e = &events[i];
+        int type = (int)e->type;
+        if (type == REALLOC && (e->old == 0 || e->ptr == 0))
+        {
+            /* realloc of NULL allocates, and realloc to size 0 frees */
+            type = e->old == 0 ? ALLOC : FREE;
+        }
+
+        if (type == FREE)
+        {
+            uint64_t addr = e->type == REALLOC ? e->old : e->ptr;
+            if ((entry = idmap_find(map, addr)) != NULL)
+                release(map, entry, fp, sum, &live);
+            continue;
+        }
+
+        long id;
+        entry = type == REALLOC ? idmap_find(map, e->old) : NULL;
+        if (entry != NULL)
+        {
+            id = entry->index;
+            live -= entry->size;
+            idmap_remove(map, e->old);
+            if (fp != NULL)
+                fprintf(fp, "r %ld %lu\n", id, (unsigned long)e->size);
+        }
+        else
+        {
+            id = sum->num_ids++;
+            if (fp != NULL)
+                fprintf(fp, "a %ld %lu\n", id, (unsigned long)e->size);
+        }
+        sum->num_ops++;
+
+        if ((entry = idmap_find(map, e->ptr)) != NULL)
+            release(map, entry, fp, sum, &live);
+        entry = idmap_insert(map, e->ptr);
+        entry->index = id;
+        entry->size = e->size;
+        live += e->size;
+        if (live > sum->peak_bytes)
+            sum->peak_bytes = live;
+    }
+    idmap_free(map);
+    return fp == NULL || !ferror(fp);
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const event_t *)a)->seq, y = ((const event_t *)b)->seq;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * write_trace - sort the raw events and write them out as a .rep file
+ */
+static void write_trace(void)
+{
+    struct stat st;
+    summary_t sum;
+    int fd = open(raw_path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+        return;
+
+    size_t n = st.st_size / sizeof(event_t);
+    event_t *events = NULL;
+    if (n > 0)
+    {
+        events = mmap(NULL, n * sizeof(event_t), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+        if (events == MAP_FAILED)
+        {
+            close(fd);
+            return;
+        }
+        qsort(events, n, sizeof(event_t), compare_seq);
+    }
+    close(fd);
+
+    FILE *fp = fopen(out_path, "w");
+    if (fp != NULL && convert(events, n, NULL, &sum))
+    {
+        /* Weight 1: counted for both utilization and throughput */
+        fprintf(fp, "1\n%ld\n%ld\n%lu\n", sum.num_ids, sum.num_ops,
+                (unsigned long)sum.peak_bytes);
+        if (convert(events, n, fp, &sum))
+            unlink(raw_path);
+    }
+    if (fp != NULL)
+        fclose(fp);
+    if (n > 0)
+        munmap(events, n * sizeof(event_t));
+}
+
+__attribute__((constructor)) static void record_init(void)
+{
+    const char *path = getenv("MM_RECORD");
+    if (path == NULL || path[0] == '\0')
+        path = "mm-record.rep";
+    snprintf(out_path, sizeof(out_path), "%s", path);
+    snprintf(raw_path, sizeof(raw_path), "%s.raw", out_path);
+
+    raw_fd = open(raw_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (raw_fd < 0 || pthread_key_create(&buffer_key, thread_exit) != 0)
+        return;
+    pthread_atfork(NULL, NULL, stop_in_child);
+    record_pid = getpid();
+    atomic_store(&recording, true);
+}
+
+__attribute__((destructor)) static void record_fini(void)
+{
+    buffer_t *buf;
+    if (getpid() != record_pid || !atomic_exchange(&recording, false))
+        return;
+
+    for (buf = atomic_load(&all_buffers); buf != NULL; buf = buf->next)
+        flush(buf);
+    close(raw_fd);
+    write_trace();
+}
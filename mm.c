@@ -41,6 +41,8 @@
 #define calloc mm_calloc
 #define memset mem_memset
 #define memcpy mem_memcpy
+#define memalign mm_memalign
+#define malloc_usable_size mm_usable_size
 #endif /* def DRIVER */
 
 /* You can change anything from here onward */
@@ -113,6 +115,46 @@ static const word_t pre_alloc_mark = 0x2;
 
 static const word_t pre_min_mark = 0x4;
 
+/**
+ * @brief Set in the header of an allocated block that realloc has grown.
+ *
+ * Such a block is likely to be grown again, so when it has to move it is
+ * given geometrically more space than asked for. The bit only survives in
+ * allocated blocks; writing a header with write_header clears it.
+ */
+static const word_t grown_mark = 0x8;
+
+/**
+ * @brief Growth factor, as a fraction of the old block size, that a grown
+ * block receives on top of the request when realloc has to move it.
+ */
+static const size_t grow_shift = 1;
+
+/**
+ * @brief Blocks at least this large give the whole pages inside them back to
+ * the system when freed, so that they stop counting toward resident memory.
+ *
+ * Large enough that the madvise call behind mem_decommit is rare next to
+ * the work of filling such a block.
+ */
+static const size_t decommit_size = (1 << 18);
+
+/**
+ * @brief Largest block size (inclusive) kept in each bounded seg list class.
+ *
+ * Blocks larger than the last entry go to the final, unbounded class. Class 0
+ * must stay at min_block_size, since mini blocks only have a next pointer.
+ *
+ * The table is generated by size-classes.pl from a histogram of the requests
+ * in the trace files: classes are narrower where requests are common, but
+ * none spans more than a doubling of size ("make classes" rewrites the lines
+ * between the markers).
+ */
+/* BEGIN SEG CLASS TABLE */
+static const size_t seg_class_limit[MAX_SEG_LIST_LENGTH - 1] = {
+    16, 32, 48, 64, 112, 176, 256, 512, 1024, 2048, 4096, 8192, 16384};
+/* END SEG CLASS TABLE */
+
 /** @brief Represents the header and payload of one block in the heap */
 typedef struct block {
     /** @brief Header contains size + allocation flag */
@@ -409,16 +451,20 @@ static block_t *find_prev(block_t *block) {
     return footer_to_header(footerp);
 }
 
+/**
+ * @brief Finds the segregated list class that holds blocks of `size` bytes.
+ *
+ * Classes are looked up in seg_class_limit, so the boundaries follow the
+ * generated table rather than a fixed power-of-two progression.
+ *
+ * @param[in] size The size of a block
+ * @return The index of the class in seg_list
+ */
 static int find_seg_list_class(size_t size) {
     int seg_list_class;
-    size_t class_step = 2 * min_block_size;
-    if (size <= min_block_size) {
-        seg_list_class = 0;
-        return seg_list_class;
-    }
-    for (seg_list_class = 1; seg_list_class < MAX_SEG_LIST_LENGTH;
-         seg_list_class++, class_step <<= 1) {
-        if (size <= class_step) {
+    for (seg_list_class = 0; seg_list_class < MAX_SEG_LIST_LENGTH - 1;
+         seg_list_class++) {
+        if (size <= seg_class_limit[seg_list_class]) {
             return seg_list_class;
         }
     }
@@ -462,12 +508,26 @@ static bool get_pre_min(block_t *block) {
     return extract_pre_min(block->header);
 }
 
+static bool get_grown(block_t *block) {
+    return (bool)(block->header & grown_mark);
+}
+
+static void set_grown(block_t *block, bool grown) {
+    if (grown) {
+        block->header |= grown_mark;
+    } else {
+        block->header &= ~grown_mark;
+    }
+}
+
 static void set_next_block_pre_alloc_pre_min(block_t *block, bool next_pre_min,
                                              bool next_pre_alloc) {
     block_t *block_next = find_next(block);
     size_t size_next = get_size(block_next);
     bool alloc = get_alloc(block_next);
+    bool grown = get_grown(block_next);
     write_header(block_next, size_next, next_pre_min, next_pre_alloc, alloc);
+    set_grown(block_next, grown);
 }
 
 static block_t *find_min_prev(block_t *block) {
@@ -674,6 +734,59 @@ static block_t *coalesce_block(block_t *block) {
     return block;
 }
 
+/**
+ * @brief Decommits the pages of a large block that has just been freed.
+ *
+ * Like the system malloc unmapping its largest blocks, only the memory of
+ * the freed block itself is given back, not that of the free neighbours it
+ * was coalesced with. Decommitting those too would mean a system call on
+ * every small free next to a large free block, and page faults whenever
+ * that space is reused soon after. The free list pointers and footer of the
+ * coalesced block are kept, so it stays on its free list. The pages read as
+ * zero once the block is reused, which is fine for malloc; calloc clears
+ * them anyway.
+ *
+ * @param[in] block The coalesced free block, already on a free list
+ * @param[in] lo The start of the payload of the freed block
+ * @param[in] hi The end of the freed block
+ */
+static void decommit_block(block_t *block, char *lo, char *hi) {
+    dbg_requires(!get_alloc(block));
+
+    char *first =
+        (char *)&block->data.free_list + sizeof(block->data.free_list);
+    char *last = (char *)header_to_footer(block);
+    if (lo < first) {
+        lo = first;
+    }
+    if (hi > last) {
+        hi = last;
+    }
+    if (hi > lo) {
+        mem_decommit(lo, (size_t)(hi - lo));
+    }
+}
+
+/**
+ * @brief Rounds up the amount to grow the heap by, so that the heap ends on
+ * a huge page boundary when memlib backs it with transparent huge pages.
+ *
+ * A huge page that straddles the end of the heap would only be partly used,
+ * so growing a huge page at a time keeps the heap made of whole ones.
+ *
+ * @param[in] size The number of bytes the heap must grow by
+ * @return The number of bytes to pass to mem_sbrk
+ */
+static size_t heap_growth(size_t size) {
+    size_t huge = mem_hugepage_size();
+    if (huge == 0) {
+        return size;
+    }
+    size_t heapsize = (size_t)((char *)mem_heap_hi() + 1 -
+                               (char *)mem_heap_lo());
+    return round_up(heapsize + size, huge) - heapsize;
+}
+
 /**
  * @brief
  *
@@ -689,7 +802,7 @@ static block_t *extend_heap(size_t size) {
     void *bp;
 
     // Allocate an even number of words to maintain alignment
-    size = round_up(size, dsize);
+    size = heap_growth(round_up(size, dsize));
     if ((bp = mem_sbrk(size)) == (void *)-1) {
         return NULL;
     }
@@ -779,6 +892,88 @@ static void split_block(block_t *block, size_t asize) {
     dbg_ensures(get_alloc(block));
 }
 
+/**
+ * @brief Shrinks an allocated block to `asize` bytes, freeing the tail.
+ *
+ * The tail is only split off when it is large enough to be a block of its
+ * own; otherwise the block keeps its size.
+ *
+ * @param[in] block An allocated block
+ * @param[in] asize The new block size, a multiple of dsize
+ */
+static void trim_block(block_t *block, size_t asize) {
+    dbg_requires(get_alloc(block));
+
+    size_t block_size = get_size(block);
+    dbg_requires(block_size >= asize);
+
+    if ((block_size - asize) < min_block_size) {
+        return;
+    }
+
+    size_t rest_size = block_size - asize;
+    write_header(block, asize, get_pre_min(block), get_pre_alloc(block), true);
+
+    // Turn the tail into an allocated block, then free it like any other
+    block_t *rest = find_next(block);
+    write_header(rest, rest_size, asize == min_block_size, true, true);
+    set_next_block_pre_alloc_pre_min(rest, rest_size == min_block_size, true);
+    free(header_to_payload(rest));
+}
+
+/**
+ * @brief Grows an allocated block to at least `asize` bytes without moving.
+ *
+ * A free block right after it is absorbed, and a block at the end of the
+ * heap is extended with mem_sbrk. Anything beyond `asize` that was absorbed
+ * is given back.
+ *
+ * @param[in] block An allocated block smaller than `asize`
+ * @param[in] asize The required block size, a multiple of dsize
+ * @return True if the block now holds at least `asize` bytes
+ */
+static bool grow_block(block_t *block, size_t asize) {
+    dbg_requires(get_alloc(block));
+    dbg_requires(get_size(block) < asize);
+
+    size_t block_size = get_size(block);
+    block_t *block_next = find_next(block);
+    size_t next_size = get_size(block_next);
+
+    // Absorb a free neighbour if it is large enough, or if it is the last
+    // block, so that the heap only needs to grow by the difference
+    if (!get_alloc(block_next) &&
+        (block_size + next_size >= asize ||
+         get_size(find_next(block_next)) == 0)) {
+        fix_free_list(block_next);
+        block_size += next_size;
+        write_header(block, block_size, get_pre_min(block),
+                     get_pre_alloc(block), true);
+        set_next_block_pre_alloc_pre_min(block, false, true);
+        block_next = find_next(block);
+    }
+
+    // At the end of the heap, move the epilogue up
+    if (block_size < asize && get_size(block_next) == 0) {
+        size_t incr = heap_growth(asize - block_size);
+        if (mem_sbrk(incr) == (void *)-1) {
+            return false;
+        }
+        block_size += incr;
+        write_header(block, block_size, get_pre_min(block),
+                     get_pre_alloc(block), true);
+        write_epilogue(find_next(block));
+        set_next_block_pre_alloc_pre_min(block, false, true);
+    }
+
+    if (block_size < asize) {
+        return false;
+    }
+
+    trim_block(block, asize);
+    return true;
+}
+
 /**
  * @brief
  *
@@ -1030,13 +1225,13 @@ bool mm_checkheap(int line) {
     for (int class = 1; class < MAX_SEG_LIST_LENGTH; class ++) {
         block_t *temp = seg_list[class];
 
-        size_t size = (2 * min_block_size) << (class - 1);
-
         while (temp != NULL) {
             size_t block_size = get_size(temp);
 
             if (class < MAX_SEG_LIST_LENGTH - 1) {
-                if (block_size > size) {
+                size_t size = seg_class_limit[class];
+                if (block_size > size ||
+                    block_size <= seg_class_limit[class - 1]) {
                     printf("###################################################"
                            "####"
                            "############\n");
@@ -1177,6 +1372,11 @@ void *malloc(size_t size) {
         return bp;
     }
 
+    // No block can be that large, and the size would wrap around below
+    if (size > SIZE_MAX - dsize - wsize) {
+        return bp;
+    }
+
     // Adjust block size to include overhead and to meet alignment requirements
     asize = round_up(size + wsize, dsize);
 
@@ -1254,6 +1454,9 @@ void free(void *bp) {
     // Try to coalesce the block with its neighbors
 
     block = coalesce_block(block);
+    if (size >= decommit_size) {
+        decommit_block(block, bp, (char *)bp - wsize + size);
+    }
 
     dbg_ensures(mm_checkheap(__LINE__));
 }
@@ -1286,13 +1489,46 @@ void *realloc(void *ptr, size_t size) {
         return malloc(size);
     }
 
-    // Otherwise, proceed with reallocation
-    newptr = malloc(size);
+    // No block can be that large, and the size would wrap around below
+    if (size > SIZE_MAX - dsize - wsize) {
+        return NULL;
+    }
+
+    // If the block's usable size already covers the request, keep it where
+    // it is and give back whatever it no longer needs. A grown block keeps
+    // its slack for the next time, unless it shrinks by more than half.
+    size_t asize = round_up(size + wsize, dsize);
+    size_t block_size = get_size(block);
+    bool grown = get_grown(block);
+    if (asize <= block_size) {
+        if (!grown || asize < block_size / 2) {
+            trim_block(block, asize);
+            set_grown(block, grown);
+        }
+        dbg_ensures(mm_checkheap(__LINE__));
+        return ptr;
+    }
+
+    // Try to grow into the space right after the block
+    if (grow_block(block, asize)) {
+        set_grown(block, true);
+        dbg_ensures(mm_checkheap(__LINE__));
+        return ptr;
+    }
+
+    // Otherwise, proceed with reallocation. A block that keeps growing gets
+    // room for the next few requests, so it need not be copied every time.
+    size_t grant = size;
+    if (grown && block_size <= SIZE_MAX / 4) {
+        grant = max(size, block_size + (block_size >> grow_shift));
+    }
+    newptr = malloc(grant);
 
     // If malloc fails, the original block is left untouched
     if (newptr == NULL) {
         return NULL;
     }
+    set_grown(payload_to_header(newptr), true);
 
     // Copy the old data
     copysize = get_payload_size(block); // gets size of old payload
@@ -1325,6 +1561,10 @@ void *calloc(size_t elements, size_t size) {
     void *bp;
     size_t asize = elements * size;
 
+    if (elements == 0) {
+        return NULL;
+    }
+
     if (asize / elements != size) {
         // Multiplication overflowed
         return NULL;
@@ -1341,6 +1581,112 @@ void *calloc(size_t elements, size_t size) {
     return bp;
 }
 
+/**
+ * @brief Allocates `size` bytes whose address is a multiple of `alignment`.
+ *
+ * The block is carved out of a larger one: the unaligned space in front of
+ * the payload is freed as a block of its own, and so is whatever is left
+ * over behind it. Since payloads are always dsize-aligned, the gap in front
+ * is a multiple of dsize and therefore always large enough to be a block.
+ *
+ * @param[in] alignment A power of two
+ * @param[in] size
+ * @return A pointer to the aligned payload, or NULL on failure
+ */
+void *memalign(size_t alignment, size_t size) {
+    dbg_requires(mm_checkheap(__LINE__));
+
+    if ((alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+
+    if (alignment <= dsize) {
+        return malloc(size);
+    }
+
+    if (size == 0 || size > SIZE_MAX - alignment - dsize) {
+        return NULL;
+    }
+
+    size_t asize = round_up(size + wsize, dsize);
+    void *bp = malloc(asize + alignment - wsize);
+    if (bp == NULL) {
+        return NULL;
+    }
+
+    block_t *block = payload_to_header(bp);
+    size_t gap = (alignment - ((uintptr_t)bp & (alignment - 1))) &
+                 (alignment - 1);
+    if (gap > 0) {
+        size_t block_size = get_size(block);
+        write_header(block, gap, get_pre_min(block), get_pre_alloc(block),
+                     true);
+
+        block_t *aligned = find_next(block);
+        write_header(aligned, block_size - gap, gap == min_block_size, true,
+                     true);
+        set_next_block_pre_alloc_pre_min(
+            aligned, (block_size - gap) == min_block_size, true);
+
+        // Give the leading gap back to the free lists
+        free(bp);
+        block = aligned;
+    }
+
+    trim_block(block, asize);
+
+    dbg_ensures(mm_checkheap(__LINE__));
+    return header_to_payload(block);
+}
+
+/**
+ * @brief Returns the number of bytes usable in an allocated block.
+ *
+ * This is at least the size that was requested, and includes the slack
+ * left by rounding the block up to the alignment.
+ *
+ * @param[in] bp A pointer to an allocated payload, or NULL
+ * @return The payload size of the block, or 0 if `bp` is NULL
+ */
+size_t malloc_usable_size(void *bp) {
+    if (bp == NULL) {
+        return 0;
+    }
+
+    block_t *block = payload_to_header(bp);
+    dbg_requires(get_alloc(block));
+    return get_payload_size(block);
+}
+
+/**
+ * @brief Counts the free blocks in the segregated lists.
+ *
+ * Every free block is on exactly one list, so this walks each list once and
+ * does not touch allocated blocks.
+ *
+ * @param[out] stats Filled with the count, total and largest free block size
+ * @return True
+ */
+bool mm_heapstats(mm_heapstats_t *stats) {
+    stats->free_blocks = 0;
+    stats->free_bytes = 0;
+    stats->largest_free = 0;
+
+    for (int class = 0; class < MAX_SEG_LIST_LENGTH; class ++) {
+        block_t *block;
+        for (block = seg_list[class]; block != NULL;
+             block = block->data.free_list.next) {
+            size_t size = get_size(block);
+            stats->free_blocks++;
+            stats->free_bytes += size;
+            if (size > stats->largest_free) {
+                stats->largest_free = size;
+            }
+        }
+    }
+    return true;
+}
+
 /*
  *****************************************************************************
  * Do not delete the following super-secret(tm) lines!                       *
@@ -6,6 +6,10 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifdef DRIVER
 
 /* declare functions for driver tests */
@@ -13,6 +17,8 @@ extern void *mm_malloc(size_t size);
 extern void mm_free(void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
 
 #else
 
@@ -56,6 +62,29 @@ extern void *realloc(void *ptr, size_t size);
  * @return A pointer to the first element of the array.
  */
 extern void *calloc(size_t nmemb, size_t size);
+
+/**
+ * @brief  Allocate memory in the heap of at least `size` bytes, starting at
+ *         a multiple of `alignment`.
+ *
+ * @param[in] alignment  The alignment of the payload, a power of two.
+ * @param[in] size  The minimum size of bytes to allocate.
+ *
+ * @return  A pointer to the beginning of the allocated bytes.
+ */
+extern void *memalign(size_t alignment, size_t size);
+
+/**
+ * @brief  Get the number of bytes that can be used in an allocated block.
+ *
+ * @param[in] ptr  A pointer to the beginning of the allocated payload.
+ *
+ * The whole usable size belongs to the caller, so a growable buffer can
+ * use it before having to call realloc.
+ *
+ * @return  The usable size, at least the size that was requested.
+ */
+extern size_t malloc_usable_size(void *ptr);
 #endif
 
 /**
@@ -74,3 +103,24 @@ extern bool mm_init(void);
  * @return  True if the heap is consistent, False otherwise.
  */
 extern bool mm_checkheap(int line);
+
+/** @brief Summary of the free blocks in the heap, filled by mm_heapstats */
+typedef struct {
+    size_t free_blocks;  /* Number of free blocks */
+    size_t free_bytes;   /* Total size of the free blocks */
+    size_t largest_free; /* Size of the largest free block */
+} mm_heapstats_t;
+
+/**
+ * @brief  Summarize the free blocks in the heap.
+ *
+ * @param[out] stats  Filled with the number, total size and largest size of
+ *                    the free blocks, headers included.
+ *
+ * @return  True if the allocator keeps these statistics, False otherwise.
+ */
+extern bool mm_heapstats(mm_heapstats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,248 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+##############################################################################
+#
+# This program builds a histogram of the block sizes requested by a set of
+# trace files and derives the segregated free list class boundaries used by
+# mm.c from it, along with the copy of them used by the TraceClasses policy
+# in mm-policy.hpp.  Classes are made narrower where requests are common,
+# so they follow the real allocation distribution instead of a fixed
+# power-of-two progression, but no class is wider than a doubling.
+#
+##############################################################################
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] [-v] [-m MMFILE] [-c POLICYFILE] [-i] [TRACE ...]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h              Print this message\n";
+    printf STDERR "  -v              Print the request histogram per class\n";
+    printf STDERR "  -m MMFILE       Allocator source (default mm.c)\n";
+    printf STDERR "  -c POLICYFILE   Policy allocator header (default mm-policy.hpp)\n";
+    printf STDERR "  -i              Rewrite the class tables in MMFILE and "
+        . "POLICYFILE in place\n";
+    printf STDERR "  -p PERCENT      Bounded classes cover this share of the "
+        . "requests (99.5)\n";
+    printf STDERR "Traces default to traces/*.rep, except the giant ones\n";
+    die "\n";
+}
+
+# Must agree with wsize, dsize and min_block_size in mm.c
+$wsize = 8;
+$dsize = 16;
+$min_block_size = 16;
+
+$begin_marker = "/* BEGIN SEG CLASS TABLE */";
+$end_marker = "/* END SEG CLASS TABLE */";
+
+getopts('hvim:c:p:');
+
+if ($opt_h) {
+    usage($ARGV[0]);
+}
+
+$mmfile = "mm.c";
+if ($opt_m) {
+    $mmfile = $opt_m;
+}
+
+$policyfile = "mm-policy.hpp";
+if ($opt_c) {
+    $policyfile = $opt_c;
+}
+
+$coverage = 99.5;
+if ($opt_p) {
+    $coverage = $opt_p;
+}
+
+@tracefiles = @ARGV;
+if (@tracefiles == 0) {
+    # Giant traces are only replayed by mdriver-emulate
+    @tracefiles = grep(!/syn-giant/, glob("traces/*.rep"));
+}
+
+# The number of classes is whatever mm.c was built with
+open(MM, "<", $mmfile) || die "Couldn't open allocator source '$mmfile'\n";
+@mmlines = <MM>;
+close(MM);
+$num_classes = 0;
+foreach $line (@mmlines) {
+    if ($line =~ /^\s*#\s*define\s+MAX_SEG_LIST_LENGTH\s+(\d+)/) {
+        $num_classes = $1;
+    }
+}
+if ($num_classes < 2) {
+    die "Couldn't find MAX_SEG_LIST_LENGTH in '$mmfile'\n";
+}
+
+# Histogram of adjusted block sizes, computed the same way as malloc does
+%count = ();
+$total = 0;
+$mini = 0;
+foreach $tracefile (@tracefiles) {
+    open(TRACE, "<", $tracefile) || die "Couldn't open trace file '$tracefile'\n";
+    $lineno = 0;
+    while (<TRACE>) {
+        $lineno++;
+        next if ($lineno <= 4);
+        if (/^\s*[ar]\s+\d+\s+(\d+)/) {
+            $size = $1;
+            next if ($size == 0);
+            $asize = $dsize * int(($size + $wsize + $dsize - 1) / $dsize);
+            $asize = $min_block_size if ($asize < $min_block_size);
+            if ($asize <= $min_block_size) {
+                $mini++;
+                next;
+            }
+            $count{$asize}++;
+            $total++;
+        }
+    }
+    close(TRACE);
+}
+if ($total == 0) {
+    die "No allocation requests found in trace files\n";
+}
+
+# Class 0 holds mini blocks only.  No other bounded class may span more
+# than a doubling of size, or the first fit in a wide class is often a
+# poor one, and together they must reach the size that covers $coverage
+# percent of the requests.  Within those limits, the requests are split so
+# that the busiest class holds as few as possible, by a binary search on
+# its share.
+@sizes = sort { $a <=> $b } keys %count;
+$num_bounded = $num_classes - 2;
+$cum = 0;
+foreach $size (@sizes) {
+    $cum += $count{$size};
+    $top = $size;
+    last if ($cum >= $coverage / 100 * $total);
+}
+$reach = $min_block_size << $num_bounded;
+$top = $reach if ($top > $reach);
+
+# Greedily cut classes holding at most $share requests each; returns the
+# limits, which fall short of $top if there are not enough classes
+sub cut_classes
+{
+    my ($share) = @_;
+    my @limits = ($min_block_size);
+    my $j = 0;
+    while (@limits <= $num_bounded && $limits[-1] < $top) {
+        my $prev = $limits[-1];
+        my $max = 2 * $prev;
+        my $limit = $prev + $dsize;
+        my $n = 0;
+        $j++ while ($j < @sizes && $sizes[$j] <= $prev);
+        while ($j < @sizes && $sizes[$j] <= $max &&
+               ($n + $count{$sizes[$j]} <= $share || $n == 0)) {
+            $n += $count{$sizes[$j]};
+            $limit = $sizes[$j];
+            $j++;
+        }
+        # Stretch a class that has room up to the next request
+        if ($j < @sizes && $n < $share && $sizes[$j] > $max) {
+            $limit = $max;
+        } elsif ($j == @sizes) {
+            $limit = $max > $top ? $top : $max;
+        }
+        push(@limits, $limit);
+    }
+    return @limits;
+}
+
+$lo = 0;
+$hi = $total;
+while ($lo < $hi) {
+    $mid = int(($lo + $hi) / 2);
+    @try = cut_classes($mid);
+    if ($try[-1] >= $top) {
+        $hi = $mid;
+    } else {
+        $lo = $mid + 1;
+    }
+}
+@limits = cut_classes($lo);
+
+# Any classes left over double up from the last one
+while (@limits <= $num_bounded) {
+    push(@limits, 2 * $limits[-1]);
+}
+
+if ($opt_v) {
+    $lo = 0;
+    for ($i = 0; $i < $num_classes; $i++) {
+        $hi = $i < @limits ? $limits[$i] : -1;
+        $n = $i == 0 ? $mini : 0;
+        foreach $size (@sizes) {
+            if ($size > $lo && ($hi < 0 || $size <= $hi)) {
+                $n += $count{$size};
+            }
+        }
+        printf STDERR "class %2d: (%8d, %8s] %8d requests\n", $i, $lo,
+            $hi < 0 ? "inf" : $hi, $n;
+        $lo = $hi;
+    }
+}
+
+# Lays out a table, bin-packed the way clang-format lays out initializers
+sub emit_table
+{
+    my ($decl, @items) = @_;
+    my @table = ("$begin_marker\n", "$decl = {\n");
+    my $line = "   ";
+    for (my $i = 0; $i < @items; $i++) {
+        my $item = " $items[$i]" . ($i == $#items ? "};" : ",");
+        if (length($line) + length($item) > 80) {
+            push(@table, "$line\n");
+            $line = "   ";
+        }
+        $line .= $item;
+    }
+    push(@table, "$line\n", "$end_marker\n");
+    return @table;
+}
+
+# Replaces the lines between the markers in a source file
+sub rewrite_file
+{
+    my ($file, @table) = @_;
+    open(SRC, "<", $file) || die "Couldn't open source '$file'\n";
+    my @lines = <SRC>;
+    close(SRC);
+    my @out = ();
+    my $state = 0;
+    foreach my $line (@lines) {
+        if ($state == 0 && index($line, $begin_marker) >= 0) {
+            push(@out, @table);
+            $state = 1;
+        } elsif ($state == 1) {
+            $state = 2 if (index($line, $end_marker) >= 0);
+        } else {
+            push(@out, $line);
+        }
+    }
+    if ($state != 2) {
+        die "Couldn't find class table markers in '$file'\n";
+    }
+    open(SRC, ">", $file) || die "Couldn't write source '$file'\n";
+    print SRC @out;
+    close(SRC);
+}
+
+@table = emit_table(
+    "static const size_t seg_class_limit[MAX_SEG_LIST_LENGTH - 1]", @limits);
+
+if (!$opt_i) {
+    print @table;
+    exit(0);
+}
+
+# The policy allocators have no mini blocks, so they start from class 1
+rewrite_file($mmfile, @table);
+rewrite_file($policyfile,
+             emit_table("static const size_t trace_class_limit[]",
+                        @limits[1 .. $#limits]));
@@ -1,158 +1,176 @@
 /*
  * Splay tree implementation
  * Based on code in https://en.wikipedia.org/wiki/Splay_tree
+ * and on Sleator's top-down splay, from "Self-adjusting Binary Search
+ * Trees" by Sleator and Tarjan
  *
  * Students are welcome to borrow and adapt this code for any
  * assignment in 15-213/18-213/15-513
  */
 
+#include <limits.h>
+
 #include "stree.h"
 
-static void free_subtree(node_t *x, free_fun_t free_fun);
-static void left_rotate(tree_t *tree, node_t *x);
-static void right_rotate(tree_t *tree, node_t *x);
-static void splay(tree_t *tree, node_t *x);
-static void replace(tree_t *tree, node_t *u, node_t *v);
-static node_t *subtree_minimum(node_t *u);
-static node_t *subtree_maximum(node_t *u);
-static void show_subtree(node_t *x, bool tree_mode);
+/* Nodes in the array at first, counting nodes[0] */
+#define MIN_NODES 1024
+
+/* Node at index i of tree */
+#define N(i) (tree->nodes[i])
+
+static tindex_t new_node(tree_t *tree);
+static tindex_t splay(tree_t *tree, tindex_t t, tkey_t key);
+static tindex_t first_overlap(tree_t *tree, tkey_t lo);
+static tindex_t subtree_minimum(tree_t *tree, tindex_t u);
+static tindex_t subtree_maximum(tree_t *tree, tindex_t u);
+static void show_subtree(tree_t *tree, tindex_t x, bool tree_mode);
 
 tree_t *tree_new()
 {
     tree_t *tree = malloc(sizeof(tree_t));
-    if (!tree)
+    if (tree)
+        tree->nodes = malloc(MIN_NODES * sizeof(node_t));
+    if (!tree || !tree->nodes)
     {
         fprintf(stderr, "ERROR.  Couldn't create range tree\n");
         exit(1);
     }
-    tree->root = NULL;
-    tree->node_count = 0;
-    tree->comparison_count = 0;
+    tree->capacity = MIN_NODES;
+    tree_reset(tree);
     return tree;
 }
 
-void tree_free(tree_t *tree, free_fun_t free_fun)
+void tree_free(tree_t *tree)
 {
-    if (tree->root)
-        free_subtree(tree->root, free_fun);
+    free(tree->nodes);
     free(tree);
 }
 
-bool tree_insert(tree_t *tree, tkey_t key, void *record)
+void tree_reset(tree_t *tree)
 {
-    node_t *z = tree->root;
-    node_t *p = NULL;
+    tree->used = 1;
+    tree->free_list = TREE_NIL;
+    tree->root = TREE_NIL;
+    tree->node_count = 0;
+    tree->comparison_count = 0;
+}
 
-    while (z)
+bool tree_insert(tree_t *tree, tkey_t lo, tkey_t hi, long index)
+{
+    tindex_t t = splay(tree, tree->root, lo);
+    if (t && N(t).range.lo == lo)
     {
-        p = z;
-        tree->comparison_count++;
-        if (key == z->key)
-            /* Already have key in tree */
-            return false;
-        tree->comparison_count++;
-        if (key > z->key)
-            z = z->right;
-        else
-            z = z->left;
+        /* Already have key in tree */
+        tree->root = t;
+        return false;
     }
 
-    z = malloc(sizeof(node_t));
-    if (!z)
+    tindex_t z = new_node(tree);
+    N(z).range.lo = lo;
+    N(z).range.hi = hi;
+    N(z).range.index = index;
+    if (!t)
+        N(z).left = N(z).right = TREE_NIL;
+    else if (lo < N(t).range.lo)
     {
-        fprintf(stderr, "ERROR.  Couldn't create range tree node\n");
-        exit(1);
+        N(z).left = N(t).left;
+        N(z).right = t;
+        N(t).left = TREE_NIL;
     }
-    z->key = key;
-    z->record = record;
-    z->parent = p;
-    z->left = z->right = NULL;
-    if (!p)
-        tree->root = z;
-    else if (p->key < z->key)
-        p->right = z;
     else
-        p->left = z;
-    splay(tree, z);
+    {
+        N(z).right = N(t).right;
+        N(z).left = t;
+        N(t).right = TREE_NIL;
+    }
+    tree->root = z;
     tree->node_count++;
     return true;
 }
 
-void *tree_find(tree_t *tree, tkey_t key)
+trange_t *tree_find(tree_t *tree, tkey_t key)
 {
-    node_t *z = tree->root;
-    while (z)
-    {
-        tree->comparison_count++;
-        if (key == z->key)
-            return z->record;
-        tree->comparison_count++;
-        if (key > z->key)
-            z = z->right;
-        else
-            z = z->left;
-    }
-    return NULL;
+    tindex_t t = tree->root = splay(tree, tree->root, key);
+    return t && N(t).range.lo == key ? &N(t).range : NULL;
 }
 
-void *tree_find_nearest(tree_t *tree, tkey_t key)
+trange_t *tree_find_nearest(tree_t *tree, tkey_t key)
 {
-    node_t *z = tree->root;
-    node_t *n = NULL;
-    while (z)
-    {
-        tree->comparison_count++;
-        if (key == z->key)
-            return z->record;
-        tree->comparison_count++;
-        if (key > z->key)
-        {
-            if (!n || n->key < z->key)
-                n = z;
-            z = z->right;
-        }
-        else
-            z = z->left;
-    }
-    return n ? n->record : NULL;
+    trange_t *prev, *next;
+    tree_find_neighbors(tree, key, &prev, &next);
+    return prev;
 }
 
-void *tree_remove(tree_t *tree, tkey_t key)
+void tree_find_neighbors(tree_t *tree, tkey_t key, trange_t **prev,
+                         trange_t **next)
 {
-    node_t *z = tree->root;
-    void *r = NULL;
-    while (z && z->key != key)
+    tindex_t t = tree->root = splay(tree, tree->root, key);
+    tindex_t p = TREE_NIL, n = TREE_NIL;
+
+    /* The root is now the nearest node on one side of key */
+    if (t && N(t).range.lo <= key)
     {
-        tree->comparison_count++;
-        if (key > z->key)
-            z = z->right;
-        else
-            z = z->left;
+        p = t;
+        if (N(t).right)
+            n = subtree_minimum(tree, N(t).right);
     }
-    if (!z)
-        return r;
-    splay(tree, z);
-    if (!z->left)
-        replace(tree, z, z->right);
-    else if (!z->right)
-        replace(tree, z, z->left);
+    else if (t)
+    {
+        n = t;
+        if (N(t).left)
+            p = subtree_maximum(tree, N(t).left);
+    }
+    *prev = p ? &N(p).range : NULL;
+    *next = n ? &N(n).range : NULL;
+}
+
+trange_t *tree_range_overlaps(tree_t *tree, tkey_t lo, tkey_t hi)
+{
+    tindex_t x = first_overlap(tree, lo);
+    return x && N(x).range.lo <= hi ? &N(x).range : NULL;
+}
+
+bool tree_remove(tree_t *tree, tkey_t key)
+{
+    tindex_t t = tree->root = splay(tree, tree->root, key);
+    if (!t || N(t).range.lo != key)
+        return false;
+
+    /* Every key on the left is less, so this splays its maximum up */
+    if (!N(t).left)
+        tree->root = N(t).right;
     else
     {
-        node_t *y = subtree_minimum(z->right);
-        if (y->parent != z)
-        {
-            replace(tree, y, y->right);
-            y->right = z->right;
-            y->right->parent = y;
-        }
-        replace(tree, z, y);
-        y->left = z->left;
-        y->left->parent = y;
+        tree->root = splay(tree, N(t).left, key);
+        N(tree->root).right = N(t).right;
     }
-    r = z->record;
     tree->node_count--;
-    free(z);
-    return r;
+    N(t).left = tree->free_list;
+    tree->free_list = t;
+    return true;
+}
+
+void tree_for_each_in_range(tree_t *tree, tkey_t lo, tkey_t hi,
+                            range_fun_t fun, void *arg)
+{
+    tindex_t x = first_overlap(tree, lo);
+    while (x && N(x).range.lo <= hi)
+    {
+        tkey_t key = N(x).range.lo;
+        fun(&N(x).range, arg);
+
+        /*
+         * Splay x up, which makes its successor the minimum of the right
+         * subtree.  Splaying the keys in order takes linear time overall.
+         */
+        x = tree->root = splay(tree, tree->root, key);
+        x = N(x).right ? subtree_minimum(tree, N(x).right) : TREE_NIL;
+    }
+}
+
+void tree_for_each(tree_t *tree, range_fun_t fun, void *arg)
+{
+    tree_for_each_in_range(tree, LONG_MIN, LONG_MAX, fun, arg);
 }
 
 void tree_show(tree_t *tree, bool tree_mode)
@@ -160,7 +178,7 @@ void tree_show(tree_t *tree, bool tree_mode)
     if (tree)
     {
         printf("[");
-        show_subtree(tree->root, tree_mode);
+        show_subtree(tree, tree->root, tree_mode);
         printf("] %ld nodes, %ld comparisons\n", tree->node_count,
                tree->comparison_count);
     }
@@ -172,128 +190,151 @@ void tree_show(tree_t *tree, bool tree_mode)
 
 /*** Helper functions ***/
 
-static void free_subtree(node_t *x, free_fun_t free_fun)
-{
-    if (!x)
-        return;
-    free_subtree(x->left, free_fun);
-    free_subtree(x->right, free_fun);
-    if (free_fun)
-        free_fun(x->record);
-    free(x);
-}
-
-static void left_rotate(tree_t *tree, node_t *x)
+/*
+ * new_node - take a node from the free list, or else from the end of the
+ *     array, doubling it when full
+ */
+static tindex_t new_node(tree_t *tree)
 {
-    node_t *y = x->right;
-    if (y)
+    tindex_t x = tree->free_list;
+    if (x)
     {
-        x->right = y->left;
-        if (y->left)
-            y->left->parent = x;
-        y->parent = x->parent;
+        tree->free_list = N(x).left;
+        return x;
     }
-    if (!x->parent)
-        tree->root = y;
-    else if (x == x->parent->left)
-        x->parent->left = y;
-    else
-        x->parent->right = y;
-    if (y)
-        y->left = x;
-    x->parent = y;
-}
-
-static void right_rotate(tree_t *tree, node_t *x)
-{
-    node_t *y = x->left;
-    if (y)
+    if (tree->used == tree->capacity)
     {
-        x->left = y->right;
-        if (y->right)
-            y->right->parent = x;
-        y->parent = x->parent;
+        node_t *nodes = NULL;
+        if (tree->capacity <= UINT32_MAX / 2)
+            nodes = realloc(tree->nodes, 2 * (size_t)tree->capacity *
+                                             sizeof(node_t));
+        if (!nodes)
+        {
+            fprintf(stderr, "ERROR.  Couldn't create range tree node\n");
+            exit(1);
+        }
+        tree->nodes = nodes;
+        tree->capacity *= 2;
     }
-    if (!x->parent)
-        tree->root = y;
-    else if (x == x->parent->left)
-        x->parent->left = y;
-    else
-        x->parent->right = y;
-    if (y)
-        y->right = x;
-    x->parent = y;
+    return tree->used++;
 }
 
-static void splay(tree_t *tree, node_t *x)
+/*
+ * splay - splay the subtree rooted at t top-down, so that its new root,
+ *     which is returned, holds key if it is there, or else a key next to
+ *     it.  The nodes passed on the way down hang off two trees, the left
+ *     one of smaller keys and the right one of larger keys, which are
+ *     built under nodes[0] and joined to the new root at the end.
+ */
+static tindex_t splay(tree_t *tree, tindex_t t, tkey_t key)
 {
-    while (x->parent)
+    tindex_t l = TREE_NIL, r = TREE_NIL, y;
+
+    if (!t)
+        return t;
+    N(TREE_NIL).left = N(TREE_NIL).right = TREE_NIL;
+    for (;;)
     {
-        if (!x->parent->parent)
-        {
-            if (x->parent->left == x)
-                right_rotate(tree, x->parent);
-            else
-                left_rotate(tree, x->parent);
-        }
-        else if (x->parent->left == x && x->parent->parent->left == x->parent)
-        {
-            right_rotate(tree, x->parent->parent);
-            right_rotate(tree, x->parent);
-        }
-        else if (x->parent->right == x && x->parent->parent->right == x->parent)
+        tree->comparison_count++;
+        if (key < N(t).range.lo)
         {
-            left_rotate(tree, x->parent->parent);
-            left_rotate(tree, x->parent);
+            if (!N(t).left)
+                break;
+            tree->comparison_count++;
+            if (key < N(N(t).left).range.lo)
+            {
+                /* Rotate right */
+                y = N(t).left;
+                N(t).left = N(y).right;
+                N(y).right = t;
+                t = y;
+                if (!N(t).left)
+                    break;
+            }
+            /* Link right */
+            N(r).left = t;
+            r = t;
+            t = N(t).left;
         }
-        else if (x->parent->left == x && x->parent->parent->right == x->parent)
+        else if (key > N(t).range.lo)
         {
-            right_rotate(tree, x->parent);
-            left_rotate(tree, x->parent);
+            if (!N(t).right)
+                break;
+            tree->comparison_count++;
+            if (key > N(N(t).right).range.lo)
+            {
+                /* Rotate left */
+                y = N(t).right;
+                N(t).right = N(y).left;
+                N(y).left = t;
+                t = y;
+                if (!N(t).right)
+                    break;
+            }
+            /* Link left */
+            N(l).right = t;
+            l = t;
+            t = N(t).right;
         }
         else
-        {
-            left_rotate(tree, x->parent);
-            right_rotate(tree, x->parent);
-        }
+            break;
     }
+
+    /* Assemble */
+    N(l).right = N(t).left;
+    N(r).left = N(t).right;
+    N(t).left = N(TREE_NIL).right;
+    N(t).right = N(TREE_NIL).left;
+    return t;
 }
 
-static void replace(tree_t *tree, node_t *u, node_t *v)
+/*
+ * first_overlap - splay lo up and find the range holding lo, if any, or
+ *     else the first range after lo.  The ranges must not overlap.
+ */
+static tindex_t first_overlap(tree_t *tree, tkey_t lo)
 {
-    if (!u->parent)
-        tree->root = v;
-    else if (u == u->parent->left)
-        u->parent->left = v;
-    else
-        u->parent->right = v;
-    if (v)
-        v->parent = u->parent;
+    tindex_t t = tree->root = splay(tree, tree->root, lo);
+    if (!t)
+        return TREE_NIL;
+    if (N(t).range.lo <= lo)
+    {
+        if (N(t).range.hi >= lo)
+            return t;
+        return N(t).right ? subtree_minimum(tree, N(t).right) : TREE_NIL;
+    }
+    if (N(t).left)
+    {
+        tindex_t p = subtree_maximum(tree, N(t).left);
+        if (N(p).range.hi >= lo)
+            return p;
+    }
+    return t;
 }
 
-static node_t *subtree_minimum(node_t *u)
+static tindex_t subtree_minimum(tree_t *tree, tindex_t u)
 {
-    while (u->left)
-        u = u->left;
+    while (N(u).left)
+        u = N(u).left;
     return u;
 }
 
-static node_t *subtree_maximum(node_t *u)
+static tindex_t subtree_maximum(tree_t *tree, tindex_t u)
 {
-    while (u->right)
-        u = u->right;
+    while (N(u).right)
+        u = N(u).right;
     return u;
 }
 
-static void show_subtree(node_t *x, bool tree_mode)
+static void show_subtree(tree_t *tree, tindex_t x, bool tree_mode)
 {
     if (!x)
         return;
     if (tree_mode)
         printf("(");
-    show_subtree(x->left, tree_mode);
-    printf(" %ld ", x->key);
-    show_subtree(x->right, tree_mode);
+    show_subtree(tree, N(x).left, tree_mode);
+    printf(" %ld ", N(x).range.lo);
+    show_subtree(tree, N(x).right, tree_mode);
     if (tree_mode)
         printf(")");
 }
@@ -4,44 +4,93 @@
  *
  * Students are welcome to borrow and adapt this code for any
  * assignment in 15-213/18-213/15-513
+ *
+ * The tree holds payload ranges keyed by their low address, and is
+ * splayed top-down on every lookup, so nodes need no parent.  Nodes live
+ * in a single array that grows as needed, and refer to each other by
+ * 32-bit index rather than by pointer, with 0 standing for none; nodes
+ * that are removed go on a free list, and tree_reset empties the tree at
+ * once.  A range returned by the tree is only valid until the next
+ * insertion, which may move the array.
  */
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 typedef long tkey_t;
 
-typedef void (*free_fun_t)(void *r);
+typedef uint32_t tindex_t;
+
+/* No node */
+#define TREE_NIL 0
+
+typedef struct {
+    tkey_t lo;  // low payload address, the key
+    tkey_t hi;  // high payload address
+    long index; // trace id of the block
+} trange_t;
 
 typedef struct node {
-    struct node *left, *right;
-    struct node *parent;
-    tkey_t key;
-    void *record;  // Points to user data */
+    tindex_t left;  // or the next free node, once removed
+    tindex_t right;
+    trange_t range;
 } node_t;
-    
+
 typedef struct {
-    node_t *root;
+    node_t *nodes;  // nodes[0] is only scratch for splaying
+    tindex_t capacity;
+    tindex_t used;       // nodes handed out, counting nodes[0]
+    tindex_t free_list;
+    tindex_t root;
     size_t node_count;
     size_t comparison_count;
 } tree_t;
 
+typedef void (*range_fun_t)(trange_t *r, void *arg);
+
 tree_t *tree_new();
 
-/* Delete all nodes in tree, applying free_fun to each record */
-void tree_free(tree_t *tree, free_fun_t free_fun);
+/* Delete the tree and all of its nodes */
+void tree_free(tree_t *tree);
+
+/* Delete all nodes in tree, keeping their space for reuse */
+void tree_reset(tree_t *tree);
 
 /* Insertion function returns false if already have key in tree */
-bool tree_insert(tree_t *tree, tkey_t key, void *record);
+bool tree_insert(tree_t *tree, tkey_t lo, tkey_t hi, long index);
 
-void *tree_find(tree_t *tree, tkey_t key);
+trange_t *tree_find(tree_t *tree, tkey_t key);
 
 /* Find element with largest key <= given key */
-void *tree_find_nearest(tree_t *tree, tkey_t key);
+trange_t *tree_find_nearest(tree_t *tree, tkey_t key);
 
-void *tree_remove(tree_t *tree, tkey_t key);
+/*
+ * Find the elements on either side of key in one pass: *prev gets the one
+ * with the largest key <= given key and *next the one with the smallest
+ * key > given key, or NULL
+ */
+void tree_find_neighbors(tree_t *tree, tkey_t key, trange_t **prev,
+                         trange_t **next);
 
-/* Print keys in tree */
-void tree_show(tree_t *tree, bool tree_mode);
+/* Returns false if key is not in tree */
+bool tree_remove(tree_t *tree, tkey_t key);
 
+/*
+ * Find a range that overlaps lo to hi, or NULL.  Assumes that the ranges
+ * in the tree do not overlap each other.
+ */
+trange_t *tree_range_overlaps(tree_t *tree, tkey_t lo, tkey_t hi);
 
+/*
+ * Apply fun to every range that overlaps lo to hi, in order of key.  fun
+ * must not change the tree.
+ */
+void tree_for_each_in_range(tree_t *tree, tkey_t lo, tkey_t hi,
+                            range_fun_t fun, void *arg);
+
+/* Apply fun to every range, in order of key */
+void tree_for_each(tree_t *tree, range_fun_t fun, void *arg);
+
+/* Print keys in tree */
+void tree_show(tree_t *tree, bool tree_mode);
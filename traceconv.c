@@ -0,0 +1,61 @@
+/*
+ * traceconv.c - convert malloc lab traces between the .rep text format and
+ * the binary format of bintrace.h
+ *
+ * The format of the input is recognized from its contents.  The output is
+ * written as text if its name ends in ".rep", and as binary otherwise:
+ *
+ *   unix> ./traceconv traces/syn-mix.rep syn-mix.bin
+ *   unix> ./traceconv syn-mix.bin syn-mix.rep
+ *
+ * mdriver reads either format, so a converted trace can be passed to -f
+ * as is.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bintrace.h"
+
+int main(int argc, char **argv)
+{
+    bintrace_t bt;
+    const char *msg;
+    FILE *fp;
+    bool ok;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <input trace> <output trace>\n", argv[0]);
+        fprintf(stderr, "The output is a .rep file if its name ends in "
+                        ".rep, and binary otherwise\n");
+        exit(1);
+    }
+
+    if ((msg = bt_open(&bt, argv[1])) != NULL)
+    {
+        fprintf(stderr, "%s: %s\n", argv[1], msg);
+        exit(1);
+    }
+
+    size_t len = strlen(argv[2]);
+    bool rep = len >= 4 && strcmp(argv[2] + len - 4, ".rep") == 0;
+    if ((fp = fopen(argv[2], rep ? "w" : "wb")) == NULL)
+    {
+        perror(argv[2]);
+        exit(1);
+    }
+    ok = rep ? bt_write_rep(&bt, fp) : bt_write_binary(&bt, fp);
+    if (fclose(fp) != 0)
+        ok = false;
+    if (!ok)
+    {
+        fprintf(stderr, "%s: write failed\n", argv[2]);
+        exit(1);
+    }
+
+    printf("%s: %lu requests in %zu bytes\n", argv[2],
+           (unsigned long)bt.num_ops, bt.ops_bytes);
+    bt_close(&bt);
+    return 0;
+}
@@ -0,0 +1,484 @@
+/*
+ * tracegen.c - generate synthetic malloc lab traces from a spec
+ *
+ * Each of the n requests is a free, a realloc or an allocation.  An
+ * allocation draws its size from the size distribution and how many
+ * requests it lives for from the lifetime distribution; a block is freed
+ * as soon as its time is up.  With realloc probability p, an allocation is
+ * followed by a realloc that grows the block to factor times its size plus
+ * add bytes, which is followed by another with the same probability, and
+ * so on, as a string or vector is built up.  If a peak is given, the
+ * blocks closest to their end are freed early whenever an allocation or a
+ * realloc would take the live bytes past it, and a chain of reallocs stops
+ * short of growing a block past it; only a single block drawn larger than
+ * the peak can pass it.  Blocks still live after the n requests are freed
+ * at the end.
+ *
+ *   unix> ./tracegen -n 8000000 -s zipf:256,1.2,16 -l pareto:50,1.1 big.bin
+ *   unix> ./tracegen -s empirical:traces/syn-mix.rep -r 0.05:1.5 mix.rep
+ *
+ * Size distributions, in bytes:
+ *   lognormal:MU,SIGMA    exp(MU + SIGMA * a standard normal)
+ *   zipf:N,S,UNIT         UNIT * k for k in 1..N, with weight 1/k^S
+ *   uniform:LO,HI         LO to HI inclusive
+ *   empirical:TRACE       sizes of the allocations in a trace
+ * Lifetime distributions, in requests:
+ *   exp:MEAN, uniform:LO,HI, lognormal:MU,SIGMA, pareto:MIN,ALPHA
+ *
+ * The same spec and seed always give the same trace.  The output is a
+ * .rep file if its name ends in ".rep", and binary otherwise.
+ */
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bintrace.h"
+
+/* Most parameters a distribution takes */
+#define MAX_PARAMS 3
+
+typedef struct
+{
+    const char *name;
+    int nparams;
+} dist_kind_t;
+
+typedef struct
+{
+    int kind; /* Index into kinds */
+    double param[MAX_PARAMS];
+    double *cdf;        /* zipf: cumulative weights of ranks 1..N */
+    size_t *samples;    /* empirical: sizes to draw from */
+    size_t nsamples;
+} dist_t;
+
+enum
+{
+    LOGNORMAL,
+    ZIPF,
+    UNIFORM,
+    EMPIRICAL,
+    EXPONENTIAL,
+    PARETO
+};
+
+static const dist_kind_t kinds[] = {
+    [LOGNORMAL] = {"lognormal", 2}, [ZIPF] = {"zipf", 3},
+    [UNIFORM] = {"uniform", 2},     [EMPIRICAL] = {"empirical", 0},
+    [EXPONENTIAL] = {"exp", 1},     [PARETO] = {"pareto", 2},
+};
+
+static const int size_kinds[] = {LOGNORMAL, ZIPF, UNIFORM, EMPIRICAL, -1};
+static const int life_kinds[] = {EXPONENTIAL, UNIFORM, LOGNORMAL, PARETO, -1};
+
+/* A live block, in a heap ordered by the request that frees it */
+typedef struct
+{
+    uint64_t death;
+    long id;
+    size_t size;
+} block_t;
+
+typedef struct
+{
+    uint64_t ops;
+    dist_t sizes;
+    dist_t lifetimes;
+    double realloc_p;
+    double realloc_factor;
+    double realloc_add;
+    uint64_t peak;  /* Cap on live bytes, or 0 for none */
+    uint64_t seed;
+    int weight;
+} spec_t;
+
+/* What a generation pass wrote, for the header of the next one */
+typedef struct
+{
+    bintrace_t bt;
+    uint64_t live;
+    block_t *heap;
+    size_t nlive;
+    size_t cap;
+    FILE *fp;     /* NULL when only counting */
+    bool binary;
+} gen_t;
+
+static uint64_t rng_state;
+
+static void usage(const char *prog);
+static void parse_dist(dist_t *d, const char *arg, const int *allowed);
+static void generate(const spec_t *spec, gen_t *g);
+
+/*
+ * rng - xorshift64*, so that a seed gives the same trace everywhere
+ */
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DUL;
+}
+
+/* Uniform on (0, 1) */
+static double uniform01(void)
+{
+    return ((rng() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double normal(void)
+{
+    return sqrt(-2.0 * log(uniform01())) * cos(2.0 * M_PI * uniform01());
+}
+
+/*
+ * draw - sample a distribution, rounded to a count of at least one
+ */
+static uint64_t draw(const dist_t *d)
+{
+    const double *a = d->param;
+    double x = 1;
+    size_t lo, hi;
+
+    switch (d->kind)
+    {
+    case LOGNORMAL:
+        x = exp(a[0] + a[1] * normal());
+        break;
+    case UNIFORM:
+        x = a[0] + (double)(rng() % (uint64_t)(a[1] - a[0] + 1));
+        break;
+    case EXPONENTIAL:
+        x = -a[0] * log(uniform01());
+        break;
+    case PARETO:
+        x = a[0] / pow(uniform01(), 1.0 / a[1]);
+        break;
+    case EMPIRICAL:
+        x = (double)d->samples[rng() % d->nsamples];
+        break;
+    case ZIPF:
+        /* Binary search for the first rank whose cumulative weight is past
+         * a uniform draw */
+        x = uniform01() * d->cdf[(size_t)a[0] - 1];
+        for (lo = 0, hi = (size_t)a[0] - 1; lo < hi;)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (d->cdf[mid] < x)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        x = (double)(lo + 1) * a[2];
+        break;
+    }
+    return x < 1 ? 1 : x > 1e15 ? (uint64_t)1e15 : (uint64_t)(x + 0.5);
+}
+
+int main(int argc, char **argv)
+{
+    spec_t spec = {.ops = 100000, .realloc_factor = 1, .seed = 1,
+                   .weight = 1};
+    gen_t g;
+    int c;
+
+    parse_dist(&spec.sizes, "lognormal:5,1.5", size_kinds);
+    parse_dist(&spec.lifetimes, "exp:1000", life_kinds);
+
+    while ((c = getopt(argc, argv, "n:s:l:r:p:S:w:h")) != EOF)
+    {
+        switch (c)
+        {
+        case 'n':
+            spec.ops = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+            parse_dist(&spec.sizes, optarg, size_kinds);
+            break;
+        case 'l':
+            parse_dist(&spec.lifetimes, optarg, life_kinds);
+            break;
+        case 'r':
+            if (sscanf(optarg, "%lf:%lf:%lf", &spec.realloc_p,
+                       &spec.realloc_factor, &spec.realloc_add) < 2 ||
+                spec.realloc_p < 0 || spec.realloc_p >= 1)
+            {
+                fprintf(stderr, "Bad realloc pattern %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            spec.peak = strtoull(optarg, NULL, 0);
+            break;
+        case 'S':
+            spec.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            spec.weight = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    /*
+     * The header needs the number of ids and requests and the peak live
+     * bytes, so a first pass only counts, and the second, from the same
+     * seed, writes
+     */
+    const char *out = argv[optind];
+    size_t len = strlen(out);
+    memset(&g, 0, sizeof(g));
+    g.binary = !(len >= 4 && strcmp(out + len - 4, ".rep") == 0);
+    generate(&spec, &g);
+
+    if ((g.fp = fopen(out, g.binary ? "wb" : "w")) == NULL)
+    {
+        perror(out);
+        exit(1);
+    }
+    bool ok = bt_put_header(&g.bt, g.fp, g.binary);
+    generate(&spec, &g);
+    if (ferror(g.fp) || fclose(g.fp) != 0 || !ok)
+    {
+        fprintf(stderr, "%s: write failed\n", out);
+        exit(1);
+    }
+
+    printf("%s: %lu requests, %lu ids, peak %lu bytes\n", out,
+           (unsigned long)g.bt.num_ops, (unsigned long)g.bt.num_ids,
+           (unsigned long)g.bt.data_bytes);
+    free(g.heap);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n <requests>] [-s <size dist>] "
+                    "[-l <lifetime dist>]\n"
+                    "\t[-r <p>:<factor>[:<add>]] [-p <peak bytes>] "
+                    "[-S <seed>] [-w <weight>] <output trace>\n",
+            prog);
+    fprintf(stderr, "Size distributions: lognormal:MU,SIGMA "
+                    "zipf:N,S,UNIT uniform:LO,HI empirical:TRACE\n");
+    fprintf(stderr, "Lifetime distributions: exp:MEAN uniform:LO,HI "
+                    "lognormal:MU,SIGMA pareto:MIN,ALPHA\n");
+    exit(1);
+}
+
+/*
+ * parse_dist - read a distribution of one of the allowed kinds, as
+ *     name:param,param,...
+ */
+static void parse_dist(dist_t *d, const char *arg, const int *allowed)
+{
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+    int i, n = 0;
+
+    for (i = 0; allowed[i] >= 0; i++)
+        if (strlen(kinds[allowed[i]].name) == len &&
+            strncmp(arg, kinds[allowed[i]].name, len) == 0)
+            break;
+    if (allowed[i] < 0 || colon == NULL)
+    {
+        fprintf(stderr, "Bad distribution %s\n", arg);
+        exit(1);
+    }
+    memset(d, 0, sizeof(*d));
+    d->kind = allowed[i];
+
+    if (d->kind == EMPIRICAL)
+    {
+        bintrace_t bt;
+        bt_cursor_t cursor;
+        traceop_t op;
+        const char *msg = bt_open(&bt, colon + 1);
+        if (msg != NULL)
+        {
+            fprintf(stderr, "%s: %s\n", colon + 1, msg);
+            exit(1);
+        }
+        if ((d->samples = malloc(bt.num_ops * sizeof(size_t) + 1)) == NULL)
+        {
+            fprintf(stderr, "Out of memory for %s\n", arg);
+            exit(1);
+        }
+        bt_rewind(&bt, &cursor);
+        while (bt_next(&cursor, &op))
+            if (op.type == ALLOC && op.size > 0)
+                d->samples[d->nsamples++] = op.size;
+        bt_close(&bt);
+        if (d->nsamples == 0)
+        {
+            fprintf(stderr, "%s: no allocations to draw sizes from\n",
+                    colon + 1);
+            exit(1);
+        }
+        return;
+    }
+
+    const char *p = colon + 1;
+    for (n = 0; n < MAX_PARAMS && *p != '\0'; n++)
+    {
+        char *end;
+        d->param[n] = strtod(p, &end);
+        if (end == p || (*end != ',' && *end != '\0'))
+            break;
+        p = *end == ',' ? end + 1 : end;
+    }
+    double *a = d->param;
+    if (n != kinds[d->kind].nparams || *p != '\0' ||
+        (d->kind == UNIFORM && (a[0] < 0 || a[1] < a[0])) ||
+        (d->kind == ZIPF && (a[0] < 1 || a[0] > 1e8 || a[2] < 1)) ||
+        (d->kind == PARETO && (a[0] <= 0 || a[1] <= 0)) ||
+        (d->kind == EXPONENTIAL && a[0] <= 0))
+    {
+        fprintf(stderr, "Bad parameters for %s\n", arg);
+        exit(1);
+    }
+
+    if (d->kind == ZIPF)
+    {
+        size_t k, ranks = (size_t)a[0];
+        double sum = 0;
+        d->cdf = malloc(ranks * sizeof(double));
+        if (d->cdf == NULL)
+        {
+            fprintf(stderr, "Out of memory for %s\n", arg);
+            exit(1);
+        }
+        for (k = 0; k < ranks; k++)
+            d->cdf[k] = sum += pow((double)(k + 1), -a[1]);
+    }
+}
+
+/*
+ * emit - count a request, and write it unless only counting
+ */
+static void emit(gen_t *g, int type, long id, size_t size)
+{
+    traceop_t op = {.type = type, .index = id, .size = size};
+    if (g->fp != NULL)
+        bt_put_op(&op, g->fp, g->binary);
+    g->bt.num_ops++;
+    g->bt.ops_bytes += bt_op_bytes(&op);
+    if (type == FREE)
+        g->live -= size;
+    else
+        g->live += size;
+    if (g->live > g->bt.data_bytes)
+        g->bt.data_bytes = g->live;
+}
+
+static void sift_down(block_t *heap, size_t n, size_t i)
+{
+    block_t b = heap[i];
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && heap[child + 1].death < heap[child].death)
+            child++;
+        if (heap[child].death >= b.death)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = b;
+}
+
+/*
+ * free_first - free the live block with the earliest death
+ */
+static void free_first(gen_t *g)
+{
+    emit(g, FREE, g->heap[0].id, g->heap[0].size);
+    g->heap[0] = g->heap[--g->nlive];
+    sift_down(g->heap, g->nlive, 0);
+}
+
+static void add_block(gen_t *g, uint64_t death, long id, size_t size)
+{
+    size_t i;
+    if (g->nlive == g->cap)
+    {
+        g->cap = g->cap ? 2 * g->cap : 1024;
+        if ((g->heap = realloc(g->heap, g->cap * sizeof(block_t))) == NULL)
+        {
+            fprintf(stderr, "Out of memory for %zu live blocks\n", g->cap);
+            exit(1);
+        }
+    }
+    for (i = g->nlive++; i > 0 && g->heap[(i - 1) / 2].death > death;
+         i = (i - 1) / 2)
+        g->heap[i] = g->heap[(i - 1) / 2];
+    g->heap[i] = (block_t){death, id, size};
+}
+
+/*
+ * generate - make the requests of a trace from a spec, writing them to
+ *     g->fp if it is set
+ */
+static void generate(const spec_t *spec, gen_t *g)
+{
+    uint64_t t;
+
+    rng_state = spec->seed * 0x9E3779B97F4A7C15UL | 1;
+    g->bt.weight = spec->weight;
+    g->bt.num_ids = 0;
+    g->bt.num_ops = 0;
+    g->bt.ops_bytes = 0;
+    g->bt.data_bytes = 0;
+    g->live = 0;
+    g->nlive = 0;
+
+    for (t = 0; g->bt.num_ops < spec->ops; t++)
+    {
+        if (g->nlive > 0 && g->heap[0].death <= t)
+        {
+            free_first(g);
+        }
+        else
+        {
+            size_t size = draw(&spec->sizes);
+            uint64_t life = draw(&spec->lifetimes);
+            long id = (long)g->bt.num_ids++;
+            while (spec->peak > 0 && g->nlive > 0 &&
+                   g->live + size > spec->peak)
+                free_first(g);
+            emit(g, ALLOC, id, size);
+
+            /* A chain of reallocs, each with probability realloc_p */
+            while (g->bt.num_ops < spec->ops &&
+                   uniform01() < spec->realloc_p)
+            {
+                size_t grown = (size_t)(size * spec->realloc_factor +
+                                        spec->realloc_add);
+                if (grown < 1)
+                    grown = 1;
+
+                /* Growing is held to the peak as well, and the chain ends
+                   when the block alone would pass it */
+                while (spec->peak > 0 && g->nlive > 0 &&
+                       g->live - size + grown > spec->peak)
+                    free_first(g);
+                if (spec->peak > 0 && g->live - size + grown > spec->peak)
+                    break;
+                g->live -= size;
+                size = grown;
+                emit(g, REALLOC, id, size);
+                t++;
+            }
+            add_block(g, t + life, id, size);
+        }
+    }
+    while (g->nlive > 0)
+        free_first(g);
+}
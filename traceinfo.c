@@ -0,0 +1,312 @@
+/*
+ * traceinfo.c - describe the requests of malloc lab traces
+ *
+ * For each trace, in either format, prints a summary of its requests and
+ * of the live bytes they add up to, histograms of request sizes and of
+ * block lifetimes, the live bytes over the course of the trace, and the
+ * chains of reallocs on a single block:
+ *
+ *   unix> ./traceinfo traces/syn-mix.rep traces/bdd-aa4.rep
+ *
+ * The alignment bound caps the utilization under mdriver's measure, the
+ * peak live bytes over the peak heap size.  Blocks start at
+ * ALIGNMENT-byte boundaries, so the heap must at some point hold the most
+ * bytes ever live with each block rounded up to a multiple of ALIGNMENT.
+ * It counts nothing else, neither headers nor fragmentation, so no real
+ * allocator reaches it; it only shows how much alignment alone costs.
+ * mdriver prints the same bound beside each trace's result.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bintrace.h"
+#include "config.h"
+
+/* Histogram buckets: 0, then the powers of two up to 2^64 */
+#define BUCKETS 66
+
+/* Width of the bars of the live-byte curve */
+#define BAR_WIDTH 40
+
+/* What is known of each id while the trace is read */
+typedef struct
+{
+    uint64_t born;       /* Request that allocated it */
+    size_t size;         /* Current size */
+    size_t first_size;   /* Size it was allocated at */
+    uint32_t reallocs;   /* Length of its realloc chain */
+    bool live;
+} idinfo_t;
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t bytes;
+} bucket_t;
+
+static void usage(const char *prog);
+static bool analyze(const char *path, int points);
+
+/*
+ * bucket - 0 for 0, else k where 2^(k-1) < x <= 2^k, plus one
+ */
+static int bucket(uint64_t x)
+{
+    return x <= 1 ? (int)x : 65 - __builtin_clzl(x - 1);
+}
+
+static uint64_t bucket_hi(int b)
+{
+    return b == 0 ? 0 : (uint64_t)1 << (b - 1);
+}
+
+static void print_histogram(const char *title, const char *unit,
+                            const bucket_t *h, bool bytes)
+{
+    uint64_t total = 0, total_bytes = 0;
+    int b;
+
+    for (b = 0; b < BUCKETS; b++)
+    {
+        total += h[b].count;
+        total_bytes += h[b].bytes;
+    }
+    if (total == 0)
+        return;
+
+    printf("\n  %-22s%12s%8s", title, "count", "%");
+    if (bytes)
+        printf("%8s", "bytes %");
+    printf("\n");
+    for (b = 0; b < BUCKETS; b++)
+    {
+        char range[64];
+        if (h[b].count == 0)
+            continue;
+        if (b <= 2)
+            snprintf(range, sizeof(range), "%lu %s",
+                     (unsigned long)bucket_hi(b), unit);
+        else
+            snprintf(range, sizeof(range), "%lu-%lu %s",
+                     (unsigned long)bucket_hi(b - 1) + 1,
+                     (unsigned long)bucket_hi(b), unit);
+        printf("  %-22s%12lu%7.1f%%", range, (unsigned long)h[b].count,
+               100.0 * h[b].count / total);
+        if (bytes)
+            printf("%7.1f%%", total_bytes ? 100.0 * h[b].bytes / total_bytes
+                                          : 0.0);
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int points = 20;
+    int c, i;
+    bool ok = true;
+
+    while ((c = getopt(argc, argv, "p:h")) != EOF)
+    {
+        switch (c)
+        {
+        case 'p':
+            points = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc || points < 1)
+        usage(argv[0]);
+
+    for (i = optind; i < argc; i++)
+        ok = analyze(argv[i], points) && ok;
+    return ok ? 0 : 1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-p <points>] <trace>...\n", prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-p <n>    Show the live bytes at n points (20).\n");
+    exit(1);
+}
+
+/*
+ * analyze - read a trace and print what it holds; false if it cannot be
+ *     read
+ */
+static bool analyze(const char *path, int points)
+{
+    bintrace_t bt;
+    bt_cursor_t cursor;
+    traceop_t op;
+    const char *msg;
+    bucket_t sizes[BUCKETS], lifetimes[BUCKETS], chains[BUCKETS];
+    uint64_t n, allocs = 0, reallocs = 0, frees = 0, null_frees = 0;
+    uint64_t shrinks = 0, unfreed = 0;
+    size_t live = 0, peak = 0, aligned = 0, peak_aligned = 0;
+    double growth = 0;  /* Final over first size, summed over chains */
+    uint64_t grown = 0; /* Chains that started from a block, not NULL */
+    int point = 0;
+
+    if ((msg = bt_open(&bt, path)) != NULL)
+    {
+        fprintf(stderr, "%s: %s\n", path, msg);
+        return false;
+    }
+    /* A short trace has fewer requests than points to show */
+    if (bt.num_ops > 0 && (uint64_t)points > bt.num_ops)
+        points = (int)bt.num_ops;
+    idinfo_t *ids = calloc(bt.num_ids + 1, sizeof(idinfo_t));
+    size_t *curve = calloc(points, sizeof(size_t));
+    if (ids == NULL || curve == NULL)
+    {
+        fprintf(stderr, "%s: out of memory for %lu ids\n", path,
+                (unsigned long)bt.num_ids);
+        bt_close(&bt);
+        free(ids);
+        free(curve);
+        return false;
+    }
+    memset(sizes, 0, sizeof(sizes));
+    memset(lifetimes, 0, sizeof(lifetimes));
+    memset(chains, 0, sizeof(chains));
+
+    bt_rewind(&bt, &cursor);
+    for (n = 0; bt_next(&cursor, &op); n++)
+    {
+        idinfo_t *id = op.index >= 0 ? &ids[op.index] : NULL;
+        switch (op.type)
+        {
+        case ALLOC:
+            allocs++;
+            sizes[bucket(op.size)].count++;
+            sizes[bucket(op.size)].bytes += op.size;
+            id->born = n;
+            id->size = id->first_size = op.size;
+            id->reallocs = 0;
+            id->live = true;
+            live += op.size;
+            aligned += ALIGNED_SIZE(op.size);
+            break;
+
+        case REALLOC:
+            reallocs++;
+            sizes[bucket(op.size)].count++;
+            sizes[bucket(op.size)].bytes += op.size;
+            if (!id->live)
+            {
+                /* A realloc of no block allocates one */
+                id->born = n;
+                id->size = id->first_size = 0;
+                id->reallocs = 0;
+                id->live = true;
+            }
+            else if (op.size < id->size)
+                shrinks++;
+            id->reallocs++;
+            live += op.size - id->size;
+            aligned += ALIGNED_SIZE(op.size) - ALIGNED_SIZE(id->size);
+            id->size = op.size;
+            break;
+
+        case FREE:
+            if (id == NULL || !id->live)
+            {
+                null_frees++;
+                break;
+            }
+            frees++;
+            lifetimes[bucket(n - id->born)].count++;
+            if (id->reallocs > 0)
+            {
+                chains[bucket(id->reallocs)].count++;
+                if (id->first_size > 0)
+                {
+                    growth += (double)id->size / id->first_size;
+                    grown++;
+                }
+            }
+            live -= id->size;
+            aligned -= ALIGNED_SIZE(id->size);
+            id->live = false;
+            break;
+        }
+
+        if (live > peak)
+            peak = live;
+        if (aligned > peak_aligned)
+            peak_aligned = aligned;
+        while (point < points && n + 1 >= (point + 1) * bt.num_ops / points)
+            curve[point++] = live;
+    }
+
+    /* Blocks that are never freed end their chains at the end */
+    uint64_t i, nchains = 0;
+    for (i = 0; i < bt.num_ids; i++)
+    {
+        if (!ids[i].live)
+            continue;
+        unfreed++;
+        if (ids[i].reallocs > 0)
+        {
+            chains[bucket(ids[i].reallocs)].count++;
+            if (ids[i].first_size > 0)
+            {
+                growth += (double)ids[i].size / ids[i].first_size;
+                grown++;
+            }
+        }
+    }
+    for (i = 0; i < BUCKETS; i++)
+        nchains += chains[i].count;
+
+    printf("%s: %lu requests, %lu ids, weight %d\n", path,
+           (unsigned long)bt.num_ops, (unsigned long)bt.num_ids, bt.weight);
+    printf("  %lu allocs, %lu reallocs, %lu frees, %lu of NULL, "
+           "%lu never freed\n",
+           (unsigned long)allocs, (unsigned long)reallocs,
+           (unsigned long)frees, (unsigned long)null_frees,
+           (unsigned long)unfreed);
+    printf("  peak live bytes %zu (header says %lu), %zu with each block "
+           "aligned to %d\n",
+           peak, (unsigned long)bt.data_bytes, peak_aligned, ALIGNMENT);
+    printf("  alignment bound on utilization %.1f%%\n",
+           peak_aligned > 0 ? 100.0 * peak / peak_aligned : 100.0);
+
+    print_histogram("request size", "B", sizes, true);
+    print_histogram("lifetime", "reqs", lifetimes, false);
+
+    if (nchains > 0)
+    {
+        print_histogram("realloc chain", "reallocs", chains, false);
+        printf("  %lu chains, mean final/first size %.2f, %lu reallocs "
+               "shrank\n",
+               (unsigned long)nchains, grown > 0 ? growth / grown : 0.0,
+               (unsigned long)shrinks);
+    }
+
+    if (peak > 0)
+    {
+        printf("\n  %12s%14s\n", "request", "live bytes");
+        for (point = 0; point < points; point++)
+        {
+            int width = (int)((double)curve[point] / peak * BAR_WIDTH + 0.5);
+            printf("  %12lu%14zu  ",
+                   (unsigned long)((point + 1) * bt.num_ops / points),
+                   curve[point]);
+            while (width-- > 0)
+                putchar('#');
+            putchar('\n');
+        }
+    }
+    printf("\n");
+
+    free(ids);
+    free(curve);
+    bt_close(&bt);
+    return true;
+}